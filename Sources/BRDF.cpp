@@ -0,0 +1,169 @@
+#include "BRDF.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BRDF_SSE
+#include <immintrin.h>
+#endif
+
+#define PI 3.1415f
+
+
+namespace {
+
+static const float BRDF_MIN_DENOMINATOR (1e-30f); // Of the distribution of normals, which a mirror (roughness 0) would zero
+
+/// Constants of a material for a batch.
+struct BRDFMaterial {
+	float alpha2;
+	float F0[3];
+	float fd[3];
+
+	BRDFMaterial (const Material& material) {
+		alpha2 = material.roughness () * material.roughness ();
+		glm::vec3 albedo = material.albedo ();
+		glm::vec3 specularColor = albedo + (glm::vec3 (1.0f) - albedo) * material.metallicness ();
+		glm::vec3 diffuseColor = BRDF::diffuse (material);
+		for (int c = 0; c < 3; c++) {
+			F0[c] = specularColor[c];
+			fd[c] = diffuseColor[c];
+		}
+	}
+};
+
+#ifdef BRDF_SSE
+// The same kernel is written once over these lanes, 4 with SSE and 8 with AVX
+
+struct Lanes4 {
+	typedef __m128 V;
+	static const size_t width = 4;
+	static inline V load (const float* p) { return _mm_loadu_ps (p); }
+	static inline void store (float* p, V v) { _mm_storeu_ps (p, v); }
+	static inline V set (float f) { return _mm_set1_ps (f); }
+	static inline V add (V a, V b) { return _mm_add_ps (a, b); }
+	static inline V sub (V a, V b) { return _mm_sub_ps (a, b); }
+	static inline V mul (V a, V b) { return _mm_mul_ps (a, b); }
+	static inline V div (V a, V b) { return _mm_div_ps (a, b); }
+	static inline V max (V a, V b) { return _mm_max_ps (a, b); }
+	static inline V sqrt (V a) { return _mm_sqrt_ps (a); }
+	/// 'value' where both 'a' and 'b' are positive, 0 elsewhere.
+	static inline V selectPositive (V a, V b, V value) { return _mm_and_ps (_mm_and_ps (_mm_cmpgt_ps (a, _mm_setzero_ps ()), _mm_cmpgt_ps (b, _mm_setzero_ps ())), value); }
+};
+
+#ifdef __AVX__
+struct Lanes8 {
+	typedef __m256 V;
+	static const size_t width = 8;
+	static inline V load (const float* p) { return _mm256_loadu_ps (p); }
+	static inline void store (float* p, V v) { _mm256_storeu_ps (p, v); }
+	static inline V set (float f) { return _mm256_set1_ps (f); }
+	static inline V add (V a, V b) { return _mm256_add_ps (a, b); }
+	static inline V sub (V a, V b) { return _mm256_sub_ps (a, b); }
+	static inline V mul (V a, V b) { return _mm256_mul_ps (a, b); }
+	static inline V div (V a, V b) { return _mm256_div_ps (a, b); }
+	static inline V max (V a, V b) { return _mm256_max_ps (a, b); }
+	static inline V sqrt (V a) { return _mm256_sqrt_ps (a); }
+	static inline V selectPositive (V a, V b, V value) { return _mm256_and_ps (_mm256_and_ps (_mm256_cmp_ps (a, _mm256_setzero_ps (), _CMP_GT_OQ), _mm256_cmp_ps (b, _mm256_setzero_ps (), _CMP_GT_OQ)), value); }
+};
+#endif
+
+template <typename L>
+inline typename L::V dot (const typename L::V* a, const typename L::V* b) {
+	return L::add (L::add (L::mul (a[0], b[0]), L::mul (a[1], b[1])), L::mul (a[2], b[2]));
+}
+
+/// Evaluations i to i + L::width - 1 of the batch, as BRDF::reflectance.
+template <typename L>
+inline void evaluateLanes (const BRDFMaterial& material, BRDFBatch& batch, size_t i) {
+	typedef typename L::V V;
+	const V zero = L::set (0.0f);
+	const V one = L::set (1.0f);
+	V n[3], w0[3], wi[3], wh[3];
+	for (int a = 0; a < 3; a++) {
+		n[a] = L::load (batch.n[a] + i);
+		w0[a] = L::load (batch.w0[a] + i);
+		wi[a] = L::load (batch.wi[a] + i);
+		wh[a] = L::add (wi[a], w0[a]);
+	}
+	// wh is normalized through its dot products, its length only vanishing when the viewer or the light is under the surface
+	V inverseLength = L::div (one, L::sqrt (L::max (dot<L> (wh, wh), L::set (BRDF_MIN_DENOMINATOR))));
+	V n_wi = dot<L> (n, wi);
+	V n_w0 = dot<L> (n, w0);
+	V n_wh = L::max (zero, L::mul (dot<L> (n, wh), inverseLength));
+	V wi_wh = L::max (zero, L::mul (dot<L> (wi, wh), inverseLength));
+
+	const V alpha2 = L::set (material.alpha2);
+	const V oneMinusAlpha2 = L::set (1.0f - material.alpha2);
+	V d = L::sub (one, L::mul (oneMinusAlpha2, L::mul (n_wh, n_wh)));
+	V D = L::div (alpha2, L::max (L::mul (L::set (PI), L::mul (d, d)), L::set (BRDF_MIN_DENOMINATOR)));
+	V G1 = L::div (L::add (n_wi, n_wi), L::add (n_wi, L::sqrt (L::add (alpha2, L::mul (oneMinusAlpha2, L::mul (n_wi, n_wi))))));
+	V G2 = L::div (L::add (n_w0, n_w0), L::add (n_w0, L::sqrt (L::add (alpha2, L::mul (oneMinusAlpha2, L::mul (n_w0, n_w0))))));
+	// D G / (4 n.wi n.w0), zero where either cosine is not positive
+	V DG = L::selectPositive (n_wi, n_w0, L::div (L::mul (D, L::mul (G1, G2)), L::max (L::mul (L::set (4.0f), L::mul (n_wi, n_w0)), L::set (BRDF_MIN_DENOMINATOR))));
+	V c = L::sub (one, wi_wh);
+	V c2 = L::mul (c, c);
+	V c5 = L::mul (L::mul (c2, c2), c);
+	V cosine = L::max (zero, n_wi);
+	for (int channel = 0; channel < 3; channel++) {
+		V F0 = L::set (material.F0[channel]);
+		V F = L::sub (F0, L::mul (c5, L::sub (one, F0)));
+		V f = L::add (L::set (material.fd[channel]), L::mul (DG, F));
+		L::store (batch.reflectance[channel] + i, L::mul (f, cosine));
+	}
+}
+#endif
+
+}
+
+
+glm::vec3 BRDF::diffuse (const Material& material) {
+	return material.albedo () / PI;
+}
+
+glm::vec3 BRDF::specular (const Material& material, const glm::vec3& w0, const glm::vec3& wi, const glm::vec3& wh, const glm::vec3& n) {
+	float n_wi = glm::dot (n, wi);
+	float n_w0 = glm::dot (n, w0);
+	// The denominator vanishes at grazing angles, and the terms are meaningless under the surface
+	if (n_wi <= 0.0f || n_w0 <= 0.0f) return glm::vec3 (0.0f);
+
+	float alpha = material.roughness ();
+	float alpha2 = alpha * alpha;
+	float n_wh = std::max (0.0f, glm::dot (n, wh));
+	float wi_wh = std::max (0.0f, glm::dot (wi, wh));
+	float d = 1.0f + (alpha2 - 1.0f) * n_wh * n_wh;
+	float D = alpha2 / std::max (PI * d * d, BRDF_MIN_DENOMINATOR);
+
+	glm::vec3 F0 = material.albedo () + (glm::vec3 (1.0f) - material.albedo ()) * material.metallicness ();
+	float c = 1.0f - wi_wh;
+	float c2 = c * c;
+	glm::vec3 F = F0 - (c2 * c2 * c) * (glm::vec3 (1.0f) - F0);
+
+	float G1 = 2.0f * n_wi / (n_wi + std::sqrt (alpha2 + (1.0f - alpha2) * n_wi * n_wi));
+	float G2 = 2.0f * n_w0 / (n_w0 + std::sqrt (alpha2 + (1.0f - alpha2) * n_w0 * n_w0));
+	return D * F * (G1 * G2) / std::max (4.0f * n_wi * n_w0, BRDF_MIN_DENOMINATOR);
+}
+
+glm::vec3 BRDF::reflectance (const Material& material, const glm::vec3& w0, const glm::vec3& wi, const glm::vec3& n) {
+	float cosine = glm::dot (n, wi);
+	if (cosine <= 0.0f) return glm::vec3 (0.0f);
+	glm::vec3 wh = glm::normalize (wi + w0);
+	return (diffuse (material) + specular (material, w0, wi, wh, n)) * cosine;
+}
+
+void BRDF::evaluate (const Material& material, BRDFBatch& batch) {
+	size_t i = 0;
+#ifdef BRDF_SSE
+	const BRDFMaterial constants (material);
+#ifdef __AVX__
+	for (; i + Lanes8::width <= batch.size; i += Lanes8::width) evaluateLanes<Lanes8> (constants, batch, i);
+#endif
+	for (; i + Lanes4::width <= batch.size; i += Lanes4::width) evaluateLanes<Lanes4> (constants, batch, i);
+#endif
+	// Remaining evaluations one by one
+	for (; i < batch.size; i++) {
+		glm::vec3 r = reflectance (material, glm::vec3 (batch.w0[0][i], batch.w0[1][i], batch.w0[2][i]), glm::vec3 (batch.wi[0][i], batch.wi[1][i], batch.wi[2][i]), glm::vec3 (batch.n[0][i], batch.n[1][i], batch.n[2][i]));
+		for (int c = 0; c < 3; c++) batch.reflectance[c][i] = r[c];
+	}
+}
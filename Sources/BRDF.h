@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include "Material.h"
+
+static const size_t BRDF_BATCH_SIZE (64); // Evaluations of a BRDFBatch, a multiple of the SIMD width
+
+/// Evaluations of the BRDF of one material, stored as structure of arrays so that they are computed
+/// 8 (AVX) or 4 (SSE) at a time. The directions are unit vectors in the same space.
+struct BRDFBatch {
+	alignas(32) float n[3][BRDF_BATCH_SIZE];
+	alignas(32) float w0[3][BRDF_BATCH_SIZE]; // Towards the viewer
+	alignas(32) float wi[3][BRDF_BATCH_SIZE]; // Towards the light
+	alignas(32) float reflectance[3][BRDF_BATCH_SIZE]; // Result: (fd + fs) max(0, n.wi), per color channel
+	size_t size = 0;
+
+	inline void push (const glm::vec3& normal, const glm::vec3& toViewer, const glm::vec3& toLight) {
+		for (int a = 0; a < 3; a++) {
+			n[a][size] = normal[a];
+			w0[a][size] = toViewer[a];
+			wi[a][size] = toLight[a];
+		}
+		size++;
+	}
+	inline glm::vec3 result (size_t i) const { return glm::vec3 (reflectance[0][i], reflectance[1][i], reflectance[2][i]); }
+	inline bool full () const { return size == BRDF_BATCH_SIZE; }
+	inline void clear () { size = 0; }
+};
+
+/// Lambertian diffuse plus GGX specular (Smith masking, Schlick style Fresnel) reflection of a Material.
+class BRDF {
+public:
+	static glm::vec3 diffuse (const Material& material);
+	/// Zero where the light or the viewer is under the surface.
+	static glm::vec3 specular (const Material& material, const glm::vec3& w0, const glm::vec3& wi, const glm::vec3& wh, const glm::vec3& n);
+	/// (fd + fs) max(0, n.wi) of a single evaluation, as stored by evaluate.
+	static glm::vec3 reflectance (const Material& material, const glm::vec3& w0, const glm::vec3& wi, const glm::vec3& n);
+
+	/// Fills the reflectance of the 'size' evaluations of the batch.
+	static void evaluate (const Material& material, BRDFBatch& batch);
+};
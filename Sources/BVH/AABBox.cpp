@@ -2,6 +2,10 @@
 
 
 bool AABBox::intersect(Ray& ray, float& tmin_) {
+    return intersect(cornerDown, cornerUp, ray, tmin_);
+}
+
+bool AABBox::intersect(const glm::vec3& cornerDown, const glm::vec3& cornerUp, const Ray& ray, float& tmin_) {
     // Slab Method
     // This is a branchless method and is known to be the fastest
     float tx1 = (cornerDown.x - ray.origin.x) * ray.inv_dir.x;
@@ -29,4 +33,14 @@ bool AABBox::intersect(Ray& ray, float& tmin_) {
     }
 
     return false;
-}
\ No newline at end of file
+}
+
+bool AABBox::overlaps(const glm::vec3& cornerDown, const glm::vec3& cornerUp, const Ray& ray, float tmin, float tmax) {
+    for (int a = 0; a < 3; a++) {
+        float t1 = (cornerDown[a] - ray.origin[a]) * ray.inv_dir[a];
+        float t2 = (cornerUp[a]   - ray.origin[a]) * ray.inv_dir[a];
+        tmin = std::max(tmin, std::min(t1, t2));
+        tmax = std::min(tmax, std::max(t1, t2));
+    }
+    return tmin <= tmax;
+}
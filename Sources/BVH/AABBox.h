@@ -8,6 +8,7 @@
 
 #include <glm/gtx/string_cast.hpp>
 #include <vector>
+#include <limits>
 
 #include "../Ray.h"
 
@@ -22,6 +23,25 @@ public:
     inline void add(std::pair<size_t, size_t> triangle) { triangles.push_back(triangle); };
 
     bool intersect(Ray& ray, float& tmin_);
+    static bool intersect(const glm::vec3& cornerDown, const glm::vec3& cornerUp, const Ray& ray, float& tmin_);
+    /// Whether the part of the ray between tmin and tmax crosses the box.
+    static bool overlaps(const glm::vec3& cornerDown, const glm::vec3& cornerUp, const Ray& ray, float tmin, float tmax);
+
+    inline void extendTo(const glm::vec3& cornerDown_, const glm::vec3& cornerUp_) {
+        cornerDown = glm::min(cornerDown, cornerDown_);
+        cornerUp   = glm::max(cornerUp, cornerUp_);
+    };
+    inline void extendTo(const AABBox& b) { extendTo(b.cornerDown, b.cornerUp); };
+    inline void setEmpty() {
+        cornerDown = glm::vec3(std::numeric_limits<float>::max());
+        cornerUp   = glm::vec3(std::numeric_limits<float>::lowest());
+    };
+
+    inline float area() const { return area(cornerDown, cornerUp); };
+    static inline float area(const glm::vec3& cornerDown, const glm::vec3& cornerUp) {
+        glm::vec3 d = cornerUp - cornerDown;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    };
 
 	glm::vec3 cornerUp;
     glm::vec3 cornerDown;
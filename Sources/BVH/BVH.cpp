@@ -1,7 +1,14 @@
 #include "BVH.h"
 
+#include <omp.h>
 
-float findMedian(std::vector<float> a, size_t n)
+#include "LBVH.h"
+#include "SBVH.h"
+
+
+namespace {
+
+float findMedian(std::vector<float>& a, size_t n)
 {
   
     // If size of the arr[] is even
@@ -42,141 +49,309 @@ float findMedian(std::vector<float> a, size_t n)
 }
 
 
-void BVH::init(const std::shared_ptr<Scene> scenePtr, bool debug) 
+/// Near the root, a node is large enough to keep all the threads busy. Below, the subtrees are built in parallel instead.
+inline bool useParallelLoops(size_t begin, size_t end) {
+    return end - begin >= BVH_PARALLEL_NODE_SIZE && !omp_in_parallel();
+}
+
+void computeBounds(const std::vector<BVHPrimitive>& primitives, size_t begin, size_t end, AABBox& box) {
+    box.setEmpty();
+    if (!useParallelLoops(begin, end)) {
+        for (size_t i = begin; i < end; i++)
+            box.extendTo(primitives[i].cornerDown, primitives[i].cornerUp);
+        return;
+    }
+
+    #pragma omp parallel
+    {
+        AABBox local;
+        local.setEmpty();
+        #pragma omp for nowait
+        for (int i = (int)begin; i < (int)end; i++)
+            local.extendTo(primitives[i].cornerDown, primitives[i].cornerUp);
+        #pragma omp critical
+        box.extendTo(local);
+    }
+}
+
+void computeCentroidBounds(const std::vector<BVHPrimitive>& primitives, size_t begin, size_t end, glm::vec3& centroidMin, glm::vec3& centroidMax) {
+    centroidMin = glm::vec3(std::numeric_limits<float>::max());
+    centroidMax = glm::vec3(std::numeric_limits<float>::lowest());
+    if (!useParallelLoops(begin, end)) {
+        for (size_t i = begin; i < end; i++) {
+            centroidMin = glm::min(centroidMin, primitives[i].centroid);
+            centroidMax = glm::max(centroidMax, primitives[i].centroid);
+        }
+        return;
+    }
+
+    #pragma omp parallel
+    {
+        glm::vec3 localMin = glm::vec3(std::numeric_limits<float>::max());
+        glm::vec3 localMax = glm::vec3(std::numeric_limits<float>::lowest());
+        #pragma omp for nowait
+        for (int i = (int)begin; i < (int)end; i++) {
+            localMin = glm::min(localMin, primitives[i].centroid);
+            localMax = glm::max(localMax, primitives[i].centroid);
+        }
+        #pragma omp critical
+        {
+            centroidMin = glm::min(centroidMin, localMin);
+            centroidMax = glm::max(centroidMax, localMax);
+        }
+    }
+}
+
+/// SAH bins of the three axes, filled in a single pass over the primitives.
+struct SAHBins {
+    AABBox boxes[3][BVH_SAH_BINS];
+    size_t counts[3][BVH_SAH_BINS];
+
+    SAHBins() {
+        for (int a = 0; a < 3; a++) {
+            for (size_t b = 0; b < BVH_SAH_BINS; b++) {
+                boxes[a][b].setEmpty();
+                counts[a][b] = 0;
+            }
+        }
+    }
+
+    inline void add(const BVHPrimitive& primitive, const glm::vec3& centroidMin, const glm::vec3& scale) {
+        for (int a = 0; a < 3; a++) {
+            size_t b = std::min(BVH_SAH_BINS - 1, (size_t)((primitive.centroid[a] - centroidMin[a]) * scale[a]));
+            boxes[a][b].extendTo(primitive.cornerDown, primitive.cornerUp);
+            counts[a][b]++;
+        }
+    }
+
+    inline void merge(const SAHBins& other) {
+        for (int a = 0; a < 3; a++) {
+            for (size_t b = 0; b < BVH_SAH_BINS; b++) {
+                boxes[a][b].extendTo(other.boxes[a][b]);
+                counts[a][b] += other.counts[a][b];
+            }
+        }
+    }
+};
+
+void fillBins(const std::vector<BVHPrimitive>& primitives, size_t begin, size_t end, const glm::vec3& centroidMin, const glm::vec3& scale, SAHBins& bins) {
+    if (!useParallelLoops(begin, end)) {
+        for (size_t i = begin; i < end; i++)
+            bins.add(primitives[i], centroidMin, scale);
+        return;
+    }
+
+    #pragma omp parallel
+    {
+        SAHBins local;
+        #pragma omp for nowait
+        for (int i = (int)begin; i < (int)end; i++)
+            local.add(primitives[i], centroidMin, scale);
+        #pragma omp critical
+        bins.merge(local);
+    }
+}
+
+}
+
+
+void BVH::init(const std::shared_ptr<Scene> scenePtr, BVHSplitMethod splitMethod, bool debug, BVHMortonPrecision mortonPrecision, size_t maxLeafSize) 
 {
     // This constructor should only be called for the root
+    clear();
+
+    // Bounds and centroids are computed once here, the nodes then only reorder the primitives
+    std::vector<BVHPrimitive> primitives;
+    gatherPrimitives(scenePtr, primitives);
+    init(scenePtr, primitives, splitMethod, debug, mortonPrecision, maxLeafSize);
+}
+
+void BVH::initMesh(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, BVHSplitMethod splitMethod, BVHMortonPrecision mortonPrecision, size_t maxLeafSize) {
+    clear();
+    std::vector<BVHPrimitive> primitives;
+    gatherPrimitives(scenePtr, meshIndex, primitives);
+    init(scenePtr, primitives, splitMethod, false, mortonPrecision, maxLeafSize);
+}
+
+void BVH::init(const std::shared_ptr<Scene>& scenePtr, std::vector<BVHPrimitive>& primitives, BVHSplitMethod splitMethod, bool debug, BVHMortonPrecision mortonPrecision, size_t maxLeafSize) {
+    if (primitives.empty()) return;
+
+    // The leaf sizes have to fit in the nodes of the wide layouts
+    maxLeafSize = std::min(std::max(maxLeafSize, (size_t)1), BVH_LEAF_SIZE_LIMIT);
+    if (splitMethod == BVHSplitMethod::LBVH)
+        LBVHBuilder::build(primitives, *this, mortonPrecision, maxLeafSize);
+    else if (splitMethod == BVHSplitMethod::SBVH)
+        SBVHBuilder::build(scenePtr, primitives, *this, BVH_SPATIAL_SPLIT_BUDGET, maxLeafSize);
+    else
+        init(scenePtr, primitives, 0, primitives.size(), splitMethod, debug, maxLeafSize, 0);
+}
+
+bool BVH::isLeafCheaper(float area, size_t count, float leftArea, size_t leftCount, float rightArea, size_t rightCount) {
+    float leafCost = BVH_INTERSECTION_COST * count * area;
+    float splitCost = BVH_TRAVERSAL_COST * area + BVH_INTERSECTION_COST * (leftArea * leftCount + rightArea * rightCount);
+    return leafCost <= splitCost;
+}
 
-    std::vector<std::pair<size_t, size_t>> triangles;
+void BVH::gatherPrimitives(const std::shared_ptr<Scene>& scenePtr, std::vector<BVHPrimitive>& primitives) {
     size_t numOfMeshes = scenePtr->numOfMeshes ();
-	for (size_t i = 0; i < numOfMeshes; i++) {
-        const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(i);
-        const size_t nbTriangles  = mesh->triangleIndices().size();
+    size_t numOfTriangles = 0;
+    for (size_t i = 0; i < numOfMeshes; i++)
+        numOfTriangles += scenePtr->mesh(i)->triangleIndices().size();
+    primitives.clear();
+    primitives.reserve(numOfTriangles);
+	for (size_t i = 0; i < numOfMeshes; i++)
+        gatherPrimitives(scenePtr, i, primitives);
+}
 
-        for(size_t k=0; k<nbTriangles; k++) {
-            triangles.push_back(std::make_pair(i, k));
-        } 
+void BVH::gatherPrimitives(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, std::vector<BVHPrimitive>& primitives) {
+    const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(meshIndex);
+    const std::vector<glm::vec3>& vertexPositions = mesh->vertexPositions();
+    const std::vector<glm::uvec3>& triangleIndices = mesh->triangleIndices();
+    const int nbTriangles = (int)triangleIndices.size();
+    const size_t offset = primitives.size();
+    primitives.resize(offset + nbTriangles);
+
+    #pragma omp parallel for if(nbTriangles >= (int)BVH_PARALLEL_NODE_SIZE)
+    for(int k=0; k<nbTriangles; k++) {
+        const glm::vec3& p0 = vertexPositions[triangleIndices[k][0]];
+        const glm::vec3& p1 = vertexPositions[triangleIndices[k][1]];
+        const glm::vec3& p2 = vertexPositions[triangleIndices[k][2]];
+
+        BVHPrimitive& primitive = primitives[offset + k];
+        primitive.mesh_index = meshIndex;
+        primitive.triangle_index = k;
+        primitive.cornerDown = glm::min(p0, glm::min(p1, p2));
+        primitive.cornerUp   = glm::max(p0, glm::max(p1, p2));
+        primitive.centroid   = 0.5f * (primitive.cornerDown + primitive.cornerUp);
     }
-
-    init(scenePtr, triangles, debug, 0);
 }
 
 
 
 
-void BVH::init(const std::shared_ptr<Scene> scenePtr, std::vector<std::pair<size_t, size_t>>& triangles, bool debug, size_t depth) {
+void BVH::init(const std::shared_ptr<Scene>& scenePtr, std::vector<BVHPrimitive>& primitives, size_t begin, size_t end, BVHSplitMethod splitMethod, bool debug, size_t maxLeafSize, size_t depth) {
     if (debug) {
         for(size_t i =0; i < 2*depth; i++) std::cout << " ";
         std::cout << "-> BVH node : ";
     }
 
-    // 0. Copy the triangle indices
-    for (size_t i = 0; i < triangles.size(); i++)
-        box.add(triangles[i].first, triangles[i].second);
-
-
     // 1. Determine the size of the box
-    float dimMin[3];
-    float dimMax[3];
-    for(int i=0; i<3; i++) {
-        dimMin[i] = std::numeric_limits<float>::max();
-        dimMax[i] = std::numeric_limits<float>::min();
-    }
-
-	for (size_t i = 0; i < triangles.size(); i++) {
-        std::pair<size_t, size_t>& pair = box.triangles[i];
-        const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(pair.first);
-        glm::uvec3& triangleIndex  = mesh->triangleIndices()[pair.second];
-        const std::vector<glm::vec3>& vertexPositions  = mesh->vertexPositions();
-        
-        for(size_t k=0; k<3; k++) {
-            for(int j=0; j<3; j++) {
-                if (vertexPositions[triangleIndex[k]][j] < dimMin[j]) dimMin[j] = vertexPositions[triangleIndex[k]][j];
-                if (vertexPositions[triangleIndex[k]][j] > dimMax[j]) dimMax[j] = vertexPositions[triangleIndex[k]][j];
-            }
-        }
-    }
-    box.cornerDown = glm::vec3(dimMin[0], dimMin[1], dimMin[2]);
-    box.cornerUp   = glm::vec3(dimMax[0], dimMax[1], dimMax[2]);
+    computeBounds(primitives, begin, end, box);
     if (debug) std::cout << "(" << box.cornerDown[0] << ", " << box.cornerDown[1] << ", " << box.cornerDown[2] << ") - (" << box.cornerUp[0] << ", " << box.cornerUp[1] << ", " << box.cornerUp[2] << ")";
 
 
     // 1.5. SHORTCUT (BASE CASE)
-    if(triangles.size() == 1) {
+    if(end - begin == 1) {
         if (debug) std::cout << " ONE TRIANGLE END" << std::endl;
+        box.add(primitives[begin].mesh_index, primitives[begin].triangle_index);
         return;
     }
-    else if(triangles.size() == 2) {
-        if (debug) std::cout << " TWO TRIANGLE END" << std::endl;
-
-        std::vector<std::pair<size_t, size_t>> triangles1;
-        triangles1.push_back(std::make_pair(triangles[0].first, triangles[0].second));
-        child_left = new BVH();
-        child_left->init(scenePtr, triangles1, debug, depth + 1);
-        
-        std::vector<std::pair<size_t, size_t>> triangles2;
-        triangles2.push_back(std::make_pair(triangles[1].first, triangles[1].second));
-        child_right = new BVH();
-        child_right->init(scenePtr, triangles2, debug, depth + 1);
 
+    // 2. Split the primitives in two non-empty sets
+    // Close to the maximal depth, halving the set keeps the remaining levels within the traversal stacks
+    size_t middle;
+    size_t remainingDepth = 0;
+    while(((size_t)1 << remainingDepth) < end - begin) remainingDepth++;
+    if (depth + remainingDepth + 1 >= BVH_MAX_DEPTH)
+        middle = splitHalf(primitives, begin, end);
+    else if (splitMethod == BVHSplitMethod::Median)
+        middle = splitMedian(scenePtr, primitives, begin, end);
+    else
+        middle = splitSAH(primitives, begin, end);
+
+    // 2.5. SAH termination: a few triangles may be cheaper to intersect together than behind two more boxes
+    if (end - begin <= maxLeafSize) {
+        AABBox left, right;
+        computeBounds(primitives, begin, middle, left);
+        computeBounds(primitives, middle, end, right);
+        if (isLeafCheaper(box.area(), end - begin, left.area(), middle - begin, right.area(), end - middle)) {
+            if (debug) std::cout << " LEAF END - Triangles: " << end - begin << std::endl;
+            axis = -1;
+            for (size_t i = begin; i < end; i++)
+                box.add(primitives[i].mesh_index, primitives[i].triangle_index);
+            return;
+        }
+    }
+    if (debug) std::cout << " - Axis " << axis << " - Split " << median << " - Triangles: " << end - begin << " (" << middle - begin << "/" << end - middle << ")" << std::endl;
+
+    // 3. Create the childs, they work on disjoint ranges of the primitives
+    child_left  = new BVH();
+    child_right = new BVH();
+#ifdef BVH_PARALLEL_TASKS
+    if (!debug && end - begin >= BVH_PARALLEL_TASK_SIZE && !useParallelLoops(begin, end)) {
+        if (omp_in_parallel()) {
+            #pragma omp task shared(scenePtr, primitives)
+            child_left->init(scenePtr, primitives, begin, middle, splitMethod, debug, maxLeafSize, depth + 1);
+            child_right->init(scenePtr, primitives, middle, end, splitMethod, debug, maxLeafSize, depth + 1);
+            #pragma omp taskwait
+        }
+        else {
+            // Below the top levels, the threads are given subtrees
+            #pragma omp parallel
+            #pragma omp single
+            {
+                #pragma omp task shared(scenePtr, primitives)
+                child_left->init(scenePtr, primitives, begin, middle, splitMethod, debug, maxLeafSize, depth + 1);
+                child_right->init(scenePtr, primitives, middle, end, splitMethod, debug, maxLeafSize, depth + 1);
+                #pragma omp taskwait
+            }
+        }
         return;
     }
+#endif
+    child_left->init(scenePtr, primitives, begin, middle, splitMethod, debug, maxLeafSize, depth + 1);  // Has at least 1
+    child_right->init(scenePtr, primitives, middle, end, splitMethod, debug, maxLeafSize, depth + 1); // Has at least 1
+}
+
 
-    // 2. Find the largest axis
+size_t BVH::splitMedian(const std::shared_ptr<Scene>& scenePtr, std::vector<BVHPrimitive>& primitives, size_t begin, size_t end) {
+    // 1. Find the largest axis
     axis = 0;
-    float size = dimMax[0] - dimMin[0];
+    float size = box.cornerUp[0] - box.cornerDown[0];
     for(int i=1; i<3; i++) {
-        float s = dimMax[i] - dimMin[i];
+        float s = box.cornerUp[i] - box.cornerDown[i];
         if(s > size) {
             size = s;
             axis = i;
         }
     }
-    if (debug) std::cout << " - Axis " << axis;
-
-
 
-    // 3. Find the median of the axis
-
-    // First we create a set with the vertex of the triangles
-    // This is useful so that if a vertex is part of several triangles it is not added several times
+    // 2. Find the median of the vertices along the axis
     std::vector<float> pos;
-    for (size_t i = 0; i < triangles.size(); i++) {
-        std::pair<size_t, size_t>& pair = box.triangles[i];
-        const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(pair.first);
-        glm::uvec3& triangleIndex  = mesh->triangleIndices()[pair.second];
+    pos.reserve(3 * (end - begin));
+    for (size_t i = begin; i < end; i++) {
+        const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(primitives[i].mesh_index);
+        const glm::uvec3& triangleIndex  = mesh->triangleIndices()[primitives[i].triangle_index];
         for(size_t k=0; k<3; k++) {
             pos.push_back(mesh->vertexPositions()[triangleIndex[k]][axis]);
         }
     }
     numOfVertex = pos.size();
-    // And find the median
     median = findMedian(pos, numOfVertex);
-    if (debug) std::cout << " - Median " << median;
-    if (debug) std::cout << " - Triangles: " << triangles.size() << " - Vertex: " << numOfVertex << std::endl;
 
 
-    // 4. Separate the triangles
-    std::vector<std::pair<size_t, size_t>> trianglesRight;
-    std::vector<std::pair<size_t, size_t>> trianglesLeft;
+    // 3. Separate the triangles
+    std::vector<BVHPrimitive> trianglesRight;
+    std::vector<BVHPrimitive> trianglesLeft;
 
-    for (size_t i = 0; i < triangles.size(); i++) {
-        std::pair<size_t, size_t> pair = box.triangles[i];
+    for (size_t i = begin; i < end; i++) {
+        const BVHPrimitive& primitive = primitives[i];
 
         bool needToAdd = true;
-        if(i+1 ==  triangles.size()) {
+        if(i+1 == end) {
             if(trianglesRight.size() == 0){
-                trianglesRight.push_back(pair);
+                trianglesRight.push_back(primitive);
                 needToAdd = false;
             }
             if(trianglesLeft.size() == 0)  {
-                trianglesLeft.push_back(pair);
+                trianglesLeft.push_back(primitive);
                 needToAdd = false;
             }
         }
 
         if(needToAdd) {
-            const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(pair.first);
-            glm::uvec3& triangleIndex  = mesh->triangleIndices()[pair.second];
+            const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(primitive.mesh_index);
+            const glm::uvec3& triangleIndex  = mesh->triangleIndices()[primitive.triangle_index];
             const std::vector<glm::vec3>& vertexPositions  = mesh->vertexPositions();
             
             size_t right = 0;
@@ -187,136 +362,266 @@ void BVH::init(const std::shared_ptr<Scene> scenePtr, std::vector<std::pair<size
             }
 
             if(equality == 3) {
-                if(trianglesRight.size() >= trianglesLeft.size()) trianglesLeft.push_back(pair);
-                else trianglesRight.push_back(pair);
+                if(trianglesRight.size() >= trianglesLeft.size()) trianglesLeft.push_back(primitive);
+                else trianglesRight.push_back(primitive);
             }
             else if(equality == 2) {
-                if(right > 0) trianglesRight.push_back(pair);
-                else trianglesLeft.push_back(pair);
+                if(right > 0) trianglesRight.push_back(primitive);
+                else trianglesLeft.push_back(primitive);
             }
             else if(equality == 1) {
-                if(right == 2) trianglesRight.push_back(pair);
-                else if(right == 0) trianglesLeft.push_back(pair);
+                if(right == 2) trianglesRight.push_back(primitive);
+                else if(right == 0) trianglesLeft.push_back(primitive);
                 else {
-                    if(trianglesRight.size() >= trianglesLeft.size()) trianglesLeft.push_back(pair);
-                    else trianglesRight.push_back(pair);
+                    if(trianglesRight.size() >= trianglesLeft.size()) trianglesLeft.push_back(primitive);
+                    else trianglesRight.push_back(primitive);
                 }
             }
-            else if(right >= 2) trianglesRight.push_back(pair);
-            else trianglesLeft.push_back(pair);
+            else if(right >= 2) trianglesRight.push_back(primitive);
+            else trianglesLeft.push_back(primitive);
         }
     }
 
-    // 5. Create the childs
-    if(triangles.size() >= 2) { // if it's not a leaf
-        child_left  = new BVH();
-        child_left->init(scenePtr, trianglesLeft, debug, depth + 1);  // Has at least 1
-        child_right = new BVH();
-        child_right->init(scenePtr, trianglesRight, debug, depth + 1); // Has at least 1
-    }
+    // The two sets are written back in place, left first
+    std::copy(trianglesLeft.begin(), trianglesLeft.end(), primitives.begin() + begin);
+    std::copy(trianglesRight.begin(), trianglesRight.end(), primitives.begin() + begin + trianglesLeft.size());
+    return begin + trianglesLeft.size();
 }
 
-BVH::~BVH() {
-    if(child_left != nullptr) delete child_left;
-    if(child_right != nullptr) delete child_right;
+
+size_t BVH::splitHalf(std::vector<BVHPrimitive>& primitives, size_t begin, size_t end) {
+    axis = 0;
+    float size = box.cornerUp[0] - box.cornerDown[0];
+    for(int i=1; i<3; i++) {
+        float s = box.cornerUp[i] - box.cornerDown[i];
+        if(s > size) {
+            size = s;
+            axis = i;
+        }
+    }
+
+    size_t middle = begin + (end - begin) / 2;
+    std::nth_element(primitives.begin() + begin, primitives.begin() + middle, primitives.begin() + end, [&](const BVHPrimitive& a, const BVHPrimitive& b) {
+        return a.centroid[axis] < b.centroid[axis];
+    });
+    median = primitives[middle].centroid[axis];
+    return middle;
 }
 
 
-bool BVH::intersect(const std::shared_ptr<Scene> scenePtr, RayHit& rayHit, Ray& ray, size_t& mesh_index, size_t& triangle_index, float tmin) {
-    // To optimize (so that we do not check useless boxes)
-    if(tmin >= rayHit.t) // Thi means that we won't find a closer intersection
-        return false;
-
-    // If we have a leaf, then no need to check intersection with box, let's check
-    // intersection with triangle to save time
-    if(child_left == nullptr) { // If it's a leaf
-        std::pair<size_t, size_t>& pair = box.triangles[0];
-        const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(pair.first);
-        glm::uvec3& triangleIndex  = mesh->triangleIndices()[pair.second];
-        glm::vec3& p0 = mesh->vertexPositions()[triangleIndex[0]];
-        glm::vec3& p1 = mesh->vertexPositions()[triangleIndex[1]];
-        glm::vec3& p2 = mesh->vertexPositions()[triangleIndex[2]];
-        
-        bool hit = ray.intersect(rayHit, p0, p1, p2);
-        if(hit) {
-            mesh_index = pair.first;
-            triangle_index = pair.second;
-            return true;
-        }
-        return false;
+size_t BVH::splitSAH(std::vector<BVHPrimitive>& primitives, size_t begin, size_t end) {
+    // 1. Bounds of the centroids, the bins are laid out between them
+    glm::vec3 centroidMin, centroidMax;
+    computeCentroidBounds(primitives, begin, end, centroidMin, centroidMax);
+    glm::vec3 scale;
+    for (int a = 0; a < 3; a++) {
+        float extent = centroidMax[a] - centroidMin[a];
+        scale[a] = (extent > 0.0f) ? BVH_SAH_BINS / extent : 0.0f;
     }
 
-    // We now check with childs
-    float tminRight = 0;
-    bool intersectRight = child_right->box.intersect(ray, tminRight);
-    float tminLeft = 0;
-    bool intersectLeft = child_left->box.intersect(ray, tminLeft);
-    
-    if(!intersectLeft && !intersectRight) return false;
-    else if(!intersectRight) return child_left->intersect(scenePtr,  rayHit, ray, mesh_index, triangle_index, tminLeft);
-    else if(!intersectLeft)  return child_right->intersect(scenePtr,  rayHit, ray, mesh_index, triangle_index, tminRight);
-    else if(tminRight < tminLeft) {
-        bool intesect_right = child_right->intersect(scenePtr, rayHit, ray, mesh_index, triangle_index, tminRight);
-        bool intesect_left  = child_left->intersect(scenePtr,  rayHit, ray, mesh_index, triangle_index, tminLeft);
-        return (intesect_left || intesect_right);
+    // 2. Evaluate the cost of every bin boundary on the three axes
+    SAHBins bins;
+    fillBins(primitives, begin, end, centroidMin, scale, bins);
+
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1;
+    size_t bestBin = 0;
+    for (int a = 0; a < 3; a++) {
+        if (scale[a] <= 0.0f) continue;
+
+        // Sweep from the right to get the area and count on the right of each boundary
+        float rightArea[BVH_SAH_BINS - 1];
+        size_t rightCount[BVH_SAH_BINS - 1];
+        AABBox accumulated;
+        accumulated.setEmpty();
+        size_t count = 0;
+        for (size_t b = BVH_SAH_BINS - 1; b > 0; b--) {
+            accumulated.extendTo(bins.boxes[a][b]);
+            count += bins.counts[a][b];
+            rightArea[b - 1] = accumulated.area();
+            rightCount[b - 1] = count;
+        }
+
+        // And from the left to evaluate the cost
+        accumulated.setEmpty();
+        count = 0;
+        for (size_t b = 0; b < BVH_SAH_BINS - 1; b++) {
+            accumulated.extendTo(bins.boxes[a][b]);
+            count += bins.counts[a][b];
+            if (count == 0 || rightCount[b] == 0) continue;
+            float cost = accumulated.area() * count + rightArea[b] * rightCount[b];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = a;
+                bestBin = b;
+            }
+        }
     }
-    else {
-        bool intesect_left  = child_left->intersect(scenePtr,  rayHit, ray, mesh_index, triangle_index, tminLeft);
-        bool intesect_right = child_right->intersect(scenePtr, rayHit, ray, mesh_index, triangle_index, tminRight);
-        return (intesect_left || intesect_right);
+
+    // 3. All the centroids are at the same place, so any split is as good as the others
+    if (bestAxis == -1) {
+        axis = 0;
+        median = centroidMin[0];
+        return begin + (end - begin) / 2;
     }
+
+    // 4. Separate the triangles
+    axis = bestAxis;
+    median = centroidMin[axis] + (bestBin + 1) / scale[axis];
+    auto middle = std::partition(primitives.begin() + begin, primitives.begin() + end, [&](const BVHPrimitive& primitive) {
+        size_t b = std::min(BVH_SAH_BINS - 1, (size_t)((primitive.centroid[axis] - centroidMin[axis]) * scale[axis]));
+        return b <= bestBin;
+    });
+    return middle - primitives.begin();
 }
 
 
-bool BVH::intersect(const std::shared_ptr<Scene> scenePtr, RayHit& rayHit, Ray& ray, size_t& mesh_index, size_t& triangle_index) {
-    float tmin = 0;
-    bool hit = box.intersect(ray, tmin);
-    if(!hit) return false;
-    return this->intersect(scenePtr, rayHit, ray, mesh_index, triangle_index, tmin);
+float BVH::computeSAHCost() const {
+    float rootArea = box.area();
+    if (rootArea <= 0.0f) return 0.0f;
+    return computeSAHCost(rootArea);
 }
 
+float BVH::computeSAHCost(float rootArea) const {
+    float relativeArea = box.area() / rootArea;
+    if (child_left == nullptr)
+        return BVH_INTERSECTION_COST * box.triangles.size() * relativeArea;
+    return BVH_TRAVERSAL_COST * relativeArea + child_left->computeSAHCost(rootArea) + child_right->computeSAHCost(rootArea);
+}
 
+size_t BVH::numOfNodes() const {
+    if (child_left == nullptr) return 1;
+    return 1 + child_left->numOfNodes() + child_right->numOfNodes();
+}
 
-bool BVH::fastIntersect(const std::shared_ptr<Scene> scenePtr, Ray& ray) {
-    float tmin = 0;
-    bool hit = box.intersect(ray, tmin);
-    if(!hit) return false;
-    return this->fastIntersect(scenePtr, ray, tmin);
+void BVH::clear() {
+    if(child_left != nullptr) delete child_left;
+    if(child_right != nullptr) delete child_right;
+    child_left = nullptr;
+    child_right = nullptr;
+    box.triangles.clear();
+    axis = -1;
+}
+
+BVH::~BVH() {
+    clear();
 }
 
-bool BVH::fastIntersect(const std::shared_ptr<Scene> scenePtr, Ray& ray, float tmin) {
-    // If we have a leaf, then no need to check intersection with box, let's check
-    // intersection with triangle to save time
-    if(child_left == nullptr) { // If it's a leaf
-        std::pair<size_t, size_t>& pair = box.triangles[0];
-        const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(pair.first);
-        glm::uvec3& triangleIndex  = mesh->triangleIndices()[pair.second];
-        glm::vec3& p0 = mesh->vertexPositions()[triangleIndex[0]];
-        glm::vec3& p1 = mesh->vertexPositions()[triangleIndex[1]];
-        glm::vec3& p2 = mesh->vertexPositions()[triangleIndex[2]];
-        
-        return ray.fastIntersect(p0, p1, p2);
+void BVH::refit(const std::shared_ptr<Scene>& scenePtr) {
+    if (child_left == nullptr) { // If it's a leaf
+        box.setEmpty();
+        for (const std::pair<size_t, size_t>& triangle : box.triangles)
+            extendToTriangle(scenePtr, triangle.first, triangle.second, box.cornerDown, box.cornerUp);
+        return;
     }
 
-    // We now check with childs
-    float tminRight = 0;
-    bool intersectRight = child_right->box.intersect(ray, tminRight);
-    float tminLeft = 0;
-    bool intersectLeft = child_left->box.intersect(ray, tminLeft);
-    
-    if(!intersectLeft && !intersectRight) return false;
-    else if(!intersectRight) return child_left->fastIntersect(scenePtr, ray, tminLeft);
-    else if(!intersectLeft)  return child_right->fastIntersect(scenePtr, ray, tminRight);
-    else if(tminRight < tminLeft) {
-        bool intersect_right = child_right->fastIntersect(scenePtr, ray, tminRight);
-        if (intersect_right) return true; // To make things faster
-        bool intersect_left  = child_left->fastIntersect(scenePtr, ray, tminLeft);
-        return intersect_left;
+    child_left->refit(scenePtr);
+    child_right->refit(scenePtr);
+    box.cornerDown = glm::min(child_left->box.cornerDown, child_right->box.cornerDown);
+    box.cornerUp = glm::max(child_left->box.cornerUp, child_right->box.cornerUp);
+}
+
+void BVH::extendToTriangle(const std::shared_ptr<Scene>& scenePtr, size_t mesh_index, size_t triangle_index, glm::vec3& cornerDown, glm::vec3& cornerUp) {
+    const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(mesh_index);
+    const glm::uvec3& triangleIndex = mesh->triangleIndices()[triangle_index];
+    const std::vector<glm::vec3>& positions = mesh->vertexPositions();
+    for (int k = 0; k < 3; k++) {
+        cornerDown = glm::min(cornerDown, positions[triangleIndex[k]]);
+        cornerUp = glm::max(cornerUp, positions[triangleIndex[k]]);
     }
-    else {
-        bool intersect_left  = child_left->fastIntersect(scenePtr, ray, tminLeft);
-        if (intersect_left) return true; // To make things faster
-        bool intersect_right = child_right->fastIntersect(scenePtr, ray, tminRight);
-        return intersect_right;
+}
+
+
+bool BVH::intersect(const std::shared_ptr<Scene>& scenePtr, RayHit& rayHit, const Ray& ray, size_t& mesh_index, size_t& triangle_index) const {
+    if(child_left == nullptr && box.triangles.empty()) return false; // Empty scene
+    float tmin = 0;
+    if(!AABBox::intersect(box.cornerDown, box.cornerUp, ray, tmin)) return false;
+
+    // Nodes still to visit, with the distance at which the ray enters them
+    struct StackEntry {
+        const BVH* node;
+        float tmin;
+    };
+    StackEntry stack[BVH_MAX_DEPTH];
+    size_t stackSize = 0;
+    stack[stackSize++] = { this, tmin };
+
+    bool hit = false;
+    while(stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+        // To optimize (so that we do not check useless boxes)
+        if(entry.tmin >= rayHit.t) // This means that we won't find a closer intersection
+            continue;
+
+        const BVH* node = entry.node;
+        if(node->child_left == nullptr) { // If it's a leaf
+            for(const std::pair<size_t, size_t>& pair : node->box.triangles) {
+                const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(pair.first);
+                const glm::uvec3& triangleIndex  = mesh->triangleIndices()[pair.second];
+                const std::vector<glm::vec3>& vertexPositions = mesh->vertexPositions();
+
+                if(ray.intersect(rayHit, vertexPositions[triangleIndex[0]], vertexPositions[triangleIndex[1]], vertexPositions[triangleIndex[2]])) {
+                    mesh_index = pair.first;
+                    triangle_index = pair.second;
+                    hit = true;
+                }
+            }
+            continue;
+        }
+
+        // We now check with childs, the closest one is pushed last to be visited first
+        float tminLeft = 0;
+        bool intersectLeft = AABBox::intersect(node->child_left->box.cornerDown, node->child_left->box.cornerUp, ray, tminLeft);
+        float tminRight = 0;
+        bool intersectRight = AABBox::intersect(node->child_right->box.cornerDown, node->child_right->box.cornerUp, ray, tminRight);
+
+        if(intersectLeft && intersectRight) {
+            if(tminRight < tminLeft) {
+                stack[stackSize++] = { node->child_left, tminLeft };
+                stack[stackSize++] = { node->child_right, tminRight };
+            }
+            else {
+                stack[stackSize++] = { node->child_right, tminRight };
+                stack[stackSize++] = { node->child_left, tminLeft };
+            }
+        }
+        else if(intersectLeft)  stack[stackSize++] = { node->child_left, tminLeft };
+        else if(intersectRight) stack[stackSize++] = { node->child_right, tminRight };
+    }
+    return hit;
+}
+
+
+bool BVH::fastIntersect(const std::shared_ptr<Scene>& scenePtr, const Ray& ray, float tmin, float tmax) const {
+    if(child_left == nullptr && box.triangles.empty()) return false; // Empty scene
+    if(!AABBox::overlaps(box.cornerDown, box.cornerUp, ray, tmin, tmax)) return false;
+
+    const BVH* stack[BVH_MAX_DEPTH];
+    size_t stackSize = 0;
+    stack[stackSize++] = this;
+
+    while(stackSize > 0) {
+        const BVH* node = stack[--stackSize];
+        if(node->child_left == nullptr) { // If it's a leaf
+            for(const std::pair<size_t, size_t>& pair : node->box.triangles) {
+                const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(pair.first);
+                const glm::uvec3& triangleIndex  = mesh->triangleIndices()[pair.second];
+                const std::vector<glm::vec3>& vertexPositions = mesh->vertexPositions();
+
+                if(ray.fastIntersect(vertexPositions[triangleIndex[0]], vertexPositions[triangleIndex[1]], vertexPositions[triangleIndex[2]], tmin, tmax))
+                    return true; // Any hit will do
+            }
+            continue;
+        }
+
+        // The child on the side of the origin along the split axis is visited first, see LinearBVH::fastIntersect
+        const BVH* nearChild = node->child_left;
+        const BVH* farChild = node->child_right;
+        if(node->axis >= 0 && ray.direction[node->axis] < 0) std::swap(nearChild, farChild);
+        if(AABBox::overlaps(farChild->box.cornerDown, farChild->box.cornerUp, ray, tmin, tmax))
+            stack[stackSize++] = farChild;
+        if(AABBox::overlaps(nearChild->box.cornerDown, nearChild->box.cornerUp, ray, tmin, tmax))
+            stack[stackSize++] = nearChild;
     }
+    return false;
 }
@@ -17,25 +17,103 @@
 #include "../Scene.h"
 
 
+// Relative costs used by the surface area heuristic
+static const float BVH_TRAVERSAL_COST (1.0f);
+static const float BVH_INTERSECTION_COST (1.0f);
+static const size_t BVH_SAH_BINS (16);
+static const size_t BVH_MAX_DEPTH (64); // Also the size of the traversal stacks
+static const size_t BVH_MAX_LEAF_SIZE (4); // Default bound of the triangles in a leaf, the SAH decides below
+static const size_t BVH_LEAF_SIZE_LIMIT (255); // Largest leaf the node layouts can store
+static const size_t BVH_PARALLEL_NODE_SIZE (1 << 16); // From this size, all the threads work on the bounds and the bins of a node
+static const size_t BVH_PARALLEL_TASK_SIZE (1 << 10); // From this size, a subtree is built in its own task
+static const float BVH_SPATIAL_SPLIT_BUDGET (0.3f); // Extra references the SBVH builder may create, relative to the number of triangles
+static const float BVH_SPATIAL_SPLIT_ALPHA (1e-5f); // Spatial splits are only tried where the object split children overlap more than this part of the root surface
+static const float BVH_REFIT_MAX_DEGRADATION (1.5f); // A refitted BVH is rebuilt once its SAH cost exceeds this ratio of the cost it was built with
+
+// Tasks appeared with OpenMP 3.0, older implementations build the subtrees one after the other
+#if defined(_OPENMP) && _OPENMP >= 200805
+#define BVH_PARALLEL_TASKS
+#endif
+
+/// How a node is split in two during the construction.
+enum class BVHSplitMethod {
+    Median, // Vertex median of the longest axis
+    SAH,    // Binned surface area heuristic
+    LBVH,   // First differing bit of the Morton codes, see LBVHBuilder
+    SBVH    // SAH with spatial splits, large triangles are clipped into several leaves, see SBVHBuilder
+};
+
+/// Bits of the Morton codes used by the LBVH builder, the knob between build speed and tree quality.
+enum class BVHMortonPrecision {
+    Bits30, // 10 bits per axis, sorted in 4 passes
+    Bits63  // 21 bits per axis, sorted in 8 passes, keeps separating close triangles of large meshes
+};
+
+/// Memory layout the built tree is converted to for the traversal.
+enum class BVHLayout {
+    Tree,   // Pointer based nodes, as built
+    Linear, // Flattened depth first node array
+    Wide4,  // 4 children per node, tested with SSE
+    Wide8   // 8 children per node, tested with AVX
+};
+
+/// Triangle data gathered once before the construction, so that nodes only shuffle these records.
+struct BVHPrimitive {
+    size_t mesh_index;
+    size_t triangle_index;
+    glm::vec3 cornerDown;
+    glm::vec3 cornerUp;
+    glm::vec3 centroid;
+};
+
+
 class BVH {
 
 public:
     BVH() {};
-    void init(const std::shared_ptr<Scene> scenePtr, bool debug = false);
-    void init(const std::shared_ptr<Scene> scenePtr, std::vector<std::pair<size_t, size_t>>& triangles, bool debug = false, size_t depth = 0);
+    /// Nodes of up to 'maxLeafSize' triangles become leaves when the SAH finds it cheaper than splitting them.
+    void init(const std::shared_ptr<Scene> scenePtr, BVHSplitMethod splitMethod = BVHSplitMethod::SAH, bool debug = false, BVHMortonPrecision mortonPrecision = BVHMortonPrecision::Bits30, size_t maxLeafSize = BVH_MAX_LEAF_SIZE);
+    /// Tree over the triangles of a single mesh, in object space.
+    void initMesh(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, BVHSplitMethod splitMethod = BVHSplitMethod::SAH, BVHMortonPrecision mortonPrecision = BVHMortonPrecision::Bits30, size_t maxLeafSize = BVH_MAX_LEAF_SIZE);
     ~BVH();
+    // A node owns its children, a copy would free them a second time
+    BVH(const BVH&) = delete;
+    BVH& operator=(const BVH&) = delete;
+    void clear();
+    /// Updates the boxes bottom-up after the vertices of the meshes moved. The topology of the tree is kept.
+    void refit(const std::shared_ptr<Scene>& scenePtr);
+
+    bool intersect(const std::shared_ptr<Scene>& scenePtr, RayHit& rayHit, const Ray& ray, size_t& mesh_index, size_t& triangle_index) const;
+    /// Any hit at a distance in [tmin, tmax).
+    bool fastIntersect(const std::shared_ptr<Scene>& scenePtr, const Ray& ray, float tmin = 0.0f, float tmax = std::numeric_limits<float>::max()) const;
+
+    /// SAH cost of the tree, relative to the surface of the root box.
+    float computeSAHCost() const;
+    size_t numOfNodes() const;
+
+    /// Bounds and centroids of all the triangles of the scene.
+    static void gatherPrimitives(const std::shared_ptr<Scene>& scenePtr, std::vector<BVHPrimitive>& primitives);
+    /// Appends the bounds and centroids of the triangles of one mesh.
+    static void gatherPrimitives(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, std::vector<BVHPrimitive>& primitives);
+    /// SAH termination test: whether 'count' triangles in a box of surface 'area' cost less as a leaf than split in the two given children.
+    static bool isLeafCheaper(float area, size_t count, float leftArea, size_t leftCount, float rightArea, size_t rightCount);
+    /// Grows the box to the triangle.
+    static void extendToTriangle(const std::shared_ptr<Scene>& scenePtr, size_t mesh_index, size_t triangle_index, glm::vec3& cornerDown, glm::vec3& cornerUp);
 
-    bool intersect(const std::shared_ptr<Scene> scenePtr, RayHit& rayHit, Ray& ray, size_t& mesh_index, size_t& triangle_index);
-    bool intersect(const std::shared_ptr<Scene> scenePtr, RayHit& rayHit, Ray& ray, size_t& mesh_index, size_t& triangle_index, float tmin);
-    bool fastIntersect(const std::shared_ptr<Scene> scenePtr, Ray& ray);
-    bool fastIntersect(const std::shared_ptr<Scene> scenePtr, Ray& ray, float tmin);
-	
 
     const std::shared_ptr<Scene> scenePtr;
-    AABBox box;
+    AABBox box; // Only the leaves store their triangles
     size_t numOfVertex = 0;
     BVH* child_left = nullptr;
     BVH* child_right = nullptr;
     int axis = -1; // 0 for x, 1 for y and z for 2
-    float median;
+    float median;  // Position of the split along the axis
+
+private:
+    void init(const std::shared_ptr<Scene>& scenePtr, std::vector<BVHPrimitive>& primitives, BVHSplitMethod splitMethod, bool debug, BVHMortonPrecision mortonPrecision, size_t maxLeafSize);
+    void init(const std::shared_ptr<Scene>& scenePtr, std::vector<BVHPrimitive>& primitives, size_t begin, size_t end, BVHSplitMethod splitMethod, bool debug, size_t maxLeafSize, size_t depth);
+    size_t splitMedian(const std::shared_ptr<Scene>& scenePtr, std::vector<BVHPrimitive>& primitives, size_t begin, size_t end);
+    size_t splitHalf(std::vector<BVHPrimitive>& primitives, size_t begin, size_t end);
+    size_t splitSAH(std::vector<BVHPrimitive>& primitives, size_t begin, size_t end);
+    float computeSAHCost(float rootArea) const;
 };
@@ -0,0 +1,284 @@
+#include "BVHCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace {
+
+/// Start of a cache file, followed by the nodes then the triangle index of every leaf slot.
+struct BVHCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t layout;
+    uint32_t splitMethod;
+    uint32_t mortonPrecision;
+    uint32_t maxLeafSize;
+    uint32_t nodeSize; // Catches a file written by a build with different node structures
+    uint32_t pad;
+    uint64_t hash;
+    uint64_t numOfNodes;
+    uint64_t numOfTriangles;
+};
+
+static const char BVH_CACHE_MAGIC[4] = { 'B', 'V', 'H', 'C' };
+
+/// Read only view of a whole file, unmapped on destruction.
+class MappedFile {
+
+public:
+    MappedFile(const std::string& filename) {
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) return;
+        const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (view == NULL) return;
+        m_data = (const uint8_t*)view;
+        m_size = (size_t)fileSize.QuadPart;
+#else
+        file = open(filename.c_str(), O_RDONLY);
+        if (file < 0) return;
+        struct stat status;
+        if (fstat(file, &status) != 0 || status.st_size == 0) return;
+        void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (view == MAP_FAILED) return;
+        m_data = (const uint8_t*)view;
+        m_size = (size_t)status.st_size;
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (m_data != nullptr) UnmapViewOfFile(m_data);
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (m_data != nullptr) munmap((void*)m_data, m_size);
+        if (file >= 0) close(file);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    inline const uint8_t* data() const { return m_data; }
+    inline size_t size() const { return m_size; }
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int file = -1;
+#endif
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+/// FNV-1a on 32 bit words.
+inline void hashWords(uint64_t& hash, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i + 4 <= size; i += 4) {
+        uint32_t word;
+        std::memcpy(&word, bytes + i, 4);
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+}
+
+// A file matching the key can still be truncated or damaged, nothing may point outside of the arrays.
+// The children come after their parent, as written by the flattening and the collapsing, so no path loops
+
+inline bool isValid(const LinearBVHNode& node, uint64_t index, uint64_t numOfNodes, uint64_t numOfTriangles) {
+    if (node.numOfTriangles > 0) return (uint64_t)node.trianglesOffset + node.numOfTriangles <= numOfTriangles;
+    // The axis indexes the ray directions in the traversals
+    return node.axis <= 2 && index + 1 < numOfNodes && index + 1 < node.rightChildOffset && node.rightChildOffset < numOfNodes;
+}
+
+template <size_t N>
+inline bool isValid(const WideBVHNode<N>& node, uint64_t index, uint64_t numOfNodes, uint64_t numOfTriangles) {
+    if (node.numOfChildren == 0 || node.numOfChildren > N) return false;
+    for (size_t i = 0; i < node.numOfChildren; i++) {
+        uint32_t reference = node.children[i] & ~WIDE_BVH_LEAF;
+        if (node.children[i] & WIDE_BVH_LEAF) {
+            if ((uint64_t)reference + node.numOfTriangles[i] > numOfTriangles) return false;
+        }
+        else if (reference <= index || reference >= numOfNodes) return false;
+    }
+    return true;
+}
+
+/// Calls 'f' with the index of every child node of the node 'index'.
+template <typename F>
+inline void forEachChild(const LinearBVHNode& node, uint32_t index, F f) {
+    if (node.numOfTriangles > 0) return;
+    f(index + 1);
+    f(node.rightChildOffset);
+}
+
+template <size_t N, typename F>
+inline void forEachChild(const WideBVHNode<N>& node, uint32_t, F f) {
+    for (size_t i = 0; i < node.numOfChildren; i++) {
+        if (!(node.children[i] & WIDE_BVH_LEAF)) f(node.children[i]);
+    }
+}
+
+}
+
+
+BVHCacheKey BVHCache::computeKey(const Mesh& mesh, BVHLayout layout, BVHSplitMethod splitMethod, BVHMortonPrecision mortonPrecision, size_t maxLeafSize) {
+    const std::vector<glm::vec3>& positions = mesh.vertexPositions();
+    const std::vector<glm::uvec3>& triangleIndices = mesh.triangleIndices();
+    uint64_t hash = 0xcbf29ce484222325ull;
+    uint64_t sizes[2] = { positions.size(), triangleIndices.size() };
+    hashWords(hash, sizes, sizeof(sizes));
+    hashWords(hash, positions.data(), positions.size() * sizeof(glm::vec3));
+    hashWords(hash, triangleIndices.data(), triangleIndices.size() * sizeof(glm::uvec3));
+    return { hash, layout, splitMethod, mortonPrecision, maxLeafSize };
+}
+
+std::string BVHCache::filename(const std::string& meshFilename, BVHLayout layout) {
+    std::string layoutName = "tree";
+    if (layout == BVHLayout::Linear) layoutName = "linear";
+    else if (layout == BVHLayout::Wide4) layoutName = "bvh4";
+    else if (layout == BVHLayout::Wide8) layoutName = "bvh8";
+    return meshFilename + "." + layoutName + ".bvh";
+}
+
+
+template <typename Node>
+bool BVHCache::load(const std::string& filename, const BVHCacheKey& key, const Mesh& mesh, size_t meshIndex, std::vector<Node>& nodes, std::vector<LinearBVHTriangle>& triangles) {
+    MappedFile file(filename);
+    if (file.size() < sizeof(BVHCacheHeader)) return false;
+
+    BVHCacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(BVHCacheHeader));
+    if (std::memcmp(header.magic, BVH_CACHE_MAGIC, 4) != 0 || header.version != BVH_CACHE_VERSION
+        || header.layout != (uint32_t)key.layout || header.splitMethod != (uint32_t)key.splitMethod
+        || header.mortonPrecision != (uint32_t)key.mortonPrecision || header.maxLeafSize != (uint32_t)key.maxLeafSize || header.nodeSize != sizeof(Node) || header.hash != key.hash)
+        return false;
+    const uint64_t nodesSize = header.numOfNodes * sizeof(Node);
+    const uint64_t trianglesSize = header.numOfTriangles * sizeof(uint32_t);
+    if (header.numOfNodes == 0 || file.size() != sizeof(BVHCacheHeader) + nodesSize + trianglesSize) return false;
+
+    nodes.resize(header.numOfNodes);
+    std::memcpy(nodes.data(), file.data() + sizeof(BVHCacheHeader), nodesSize);
+    // The depth of a node is known once the nodes before it are checked, the deeper trees would overflow the traversal stacks
+    std::vector<uint32_t> depths(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (!isValid(nodes[i], i, header.numOfNodes, header.numOfTriangles) || depths[i] >= BVH_MAX_DEPTH) {
+            nodes.clear();
+            return false;
+        }
+        forEachChild(nodes[i], (uint32_t)i, [&](uint32_t child) { depths[child] = std::max(depths[child], depths[i] + 1); });
+    }
+
+    // Only the triangles of the mesh are stored, the mesh index is the one of this scene
+    const uint8_t* triangleData = file.data() + sizeof(BVHCacheHeader) + nodesSize;
+    const size_t numOfMeshTriangles = mesh.triangleIndices().size();
+    triangles.resize(header.numOfTriangles);
+    for (size_t i = 0; i < triangles.size(); i++) {
+        uint32_t triangle_index;
+        std::memcpy(&triangle_index, triangleData + i * sizeof(uint32_t), sizeof(uint32_t));
+        if (triangle_index >= numOfMeshTriangles) {
+            nodes.clear();
+            triangles.clear();
+            return false;
+        }
+        triangles[i] = { (uint32_t)meshIndex, triangle_index };
+    }
+    return true;
+}
+
+template <typename Node>
+bool BVHCache::save(const std::string& filename, const BVHCacheKey& key, const std::vector<Node>& nodes, const std::vector<LinearBVHTriangle>& triangles) {
+    if (nodes.empty()) return false;
+
+    BVHCacheHeader header;
+    std::memcpy(header.magic, BVH_CACHE_MAGIC, 4);
+    header.version = BVH_CACHE_VERSION;
+    header.layout = (uint32_t)key.layout;
+    header.splitMethod = (uint32_t)key.splitMethod;
+    header.mortonPrecision = (uint32_t)key.mortonPrecision;
+    header.maxLeafSize = (uint32_t)key.maxLeafSize;
+    header.nodeSize = sizeof(Node);
+    header.pad = 0;
+    header.hash = key.hash;
+    header.numOfNodes = nodes.size();
+    header.numOfTriangles = triangles.size();
+
+    std::vector<uint32_t> triangleIndices(triangles.size());
+    for (size_t i = 0; i < triangles.size(); i++) triangleIndices[i] = triangles[i].triangle_index;
+
+    // Written aside then renamed, so that a concurrent run never maps a partial file
+    const std::string temporaryFilename = filename + ".tmp";
+    {
+        std::ofstream out(temporaryFilename, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write((const char*)&header, sizeof(BVHCacheHeader));
+        out.write((const char*)nodes.data(), nodes.size() * sizeof(Node));
+        out.write((const char*)triangleIndices.data(), triangleIndices.size() * sizeof(uint32_t));
+        if (!out) {
+            out.close();
+            std::remove(temporaryFilename.c_str());
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporaryFilename, filename, error);
+    if (error) {
+        std::remove(temporaryFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+bool BVHCache::load(const std::string& filename, const BVHCacheKey& key, const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, LinearBVH& bvh) {
+    bvh.clear();
+    if (!load(filename, key, *scenePtr->mesh(meshIndex), meshIndex, bvh.nodes, bvh.triangles)) return false;
+    LinearBVH::precomputeTriangles(scenePtr, bvh.triangles, bvh.precomputedTriangles);
+    return true;
+}
+
+bool BVHCache::load(const std::string& filename, const BVHCacheKey& key, const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, BVH4& bvh) {
+    bvh.clear();
+    if (!load(filename, key, *scenePtr->mesh(meshIndex), meshIndex, bvh.nodes, bvh.triangles)) return false;
+    LinearBVH::precomputeTriangles(scenePtr, bvh.triangles, bvh.precomputedTriangles);
+    return true;
+}
+
+bool BVHCache::load(const std::string& filename, const BVHCacheKey& key, const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, BVH8& bvh) {
+    bvh.clear();
+    if (!load(filename, key, *scenePtr->mesh(meshIndex), meshIndex, bvh.nodes, bvh.triangles)) return false;
+    LinearBVH::precomputeTriangles(scenePtr, bvh.triangles, bvh.precomputedTriangles);
+    return true;
+}
+
+bool BVHCache::save(const std::string& filename, const BVHCacheKey& key, const LinearBVH& bvh) {
+    return save(filename, key, bvh.nodes, bvh.triangles);
+}
+
+bool BVHCache::save(const std::string& filename, const BVHCacheKey& key, const BVH4& bvh) {
+    return save(filename, key, bvh.nodes, bvh.triangles);
+}
+
+bool BVHCache::save(const std::string& filename, const BVHCacheKey& key, const BVH8& bvh) {
+    return save(filename, key, bvh.nodes, bvh.triangles);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "BVH.h"
+#include "LinearBVH.h"
+#include "WideBVH.h"
+#include "../Mesh.h"
+#include "../Scene.h"
+
+
+static const uint32_t BVH_CACHE_VERSION (2); // To increase whenever the nodes or the construction change
+
+/// What a cached BVH must match to be reused: the mesh content and the construction settings.
+struct BVHCacheKey {
+    uint64_t hash; // Of the vertex positions and the triangle indices
+    BVHLayout layout;
+    BVHSplitMethod splitMethod;
+    BVHMortonPrecision mortonPrecision;
+    size_t maxLeafSize;
+};
+
+
+/// Binary files storing the nodes and the triangle order of the BVH of a mesh, next to the mesh file.
+/// A file is memory mapped and copied as is, so loading costs about as much as reading it.
+/// The pointer based tree layout is not cached.
+class BVHCache {
+
+public:
+    static BVHCacheKey computeKey(const Mesh& mesh, BVHLayout layout, BVHSplitMethod splitMethod, BVHMortonPrecision mortonPrecision, size_t maxLeafSize);
+    /// Cache file of a mesh file, one per layout.
+    static std::string filename(const std::string& meshFilename, BVHLayout layout);
+
+    /// Fills 'bvh' with the BVH of the mesh stored in 'filename'. Returns false, leaving 'bvh' empty, if there is
+    /// no such file, if it does not match 'key' or if its nodes do not make a tree the traversals can go through.
+    static bool load(const std::string& filename, const BVHCacheKey& key, const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, LinearBVH& bvh);
+    static bool load(const std::string& filename, const BVHCacheKey& key, const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, BVH4& bvh);
+    static bool load(const std::string& filename, const BVHCacheKey& key, const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, BVH8& bvh);
+
+    /// Returns false if the file could not be written.
+    static bool save(const std::string& filename, const BVHCacheKey& key, const LinearBVH& bvh);
+    static bool save(const std::string& filename, const BVHCacheKey& key, const BVH4& bvh);
+    static bool save(const std::string& filename, const BVHCacheKey& key, const BVH8& bvh);
+
+private:
+    template <typename Node>
+    static bool load(const std::string& filename, const BVHCacheKey& key, const Mesh& mesh, size_t meshIndex, std::vector<Node>& nodes, std::vector<LinearBVHTriangle>& triangles);
+    template <typename Node>
+    static bool save(const std::string& filename, const BVHCacheKey& key, const std::vector<Node>& nodes, const std::vector<LinearBVHTriangle>& triangles);
+};
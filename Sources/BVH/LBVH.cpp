@@ -0,0 +1,125 @@
+#include "LBVH.h"
+
+#include <omp.h>
+
+
+inline int highestBit(uint64_t x) {
+    int bit = -1;
+    while (x != 0) {
+        x >>= 1;
+        bit++;
+    }
+    return bit;
+}
+
+
+void LBVHBuilder::build(const std::vector<BVHPrimitive>& primitives, BVH& bvh, BVHMortonPrecision precision, size_t maxLeafSize) {
+    const int numOfPrimitives = (int)primitives.size();
+    if (numOfPrimitives == 0) return;
+    const bool parallel = primitives.size() >= BVH_PARALLEL_NODE_SIZE;
+
+    // 1. Bounds of the centroids, the Morton grid is laid out between them
+    glm::vec3 centroidMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 centroidMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for (const BVHPrimitive& primitive : primitives) {
+        centroidMin = glm::min(centroidMin, primitive.centroid);
+        centroidMax = glm::max(centroidMax, primitive.centroid);
+    }
+
+    // 2. Morton code of every centroid, x y z interleaved from the highest bit
+    const int bitsPerAxis = (precision == BVHMortonPrecision::Bits63) ? 21 : 10;
+    const float cells = (float)((1u << bitsPerAxis) - 1);
+    glm::vec3 scale;
+    for (int a = 0; a < 3; a++) {
+        float extent = centroidMax[a] - centroidMin[a];
+        scale[a] = (extent > 0.0f) ? cells / extent : 0.0f;
+    }
+
+    std::vector<uint64_t> codes(primitives.size());
+    std::vector<uint32_t> order(primitives.size());
+    #pragma omp parallel for if(parallel)
+    for (int i = 0; i < numOfPrimitives; i++) {
+        glm::vec3 cell = (primitives[i].centroid - centroidMin) * scale;
+        uint64_t x = (uint64_t)std::min(cells, std::max(0.0f, cell.x));
+        uint64_t y = (uint64_t)std::min(cells, std::max(0.0f, cell.y));
+        uint64_t z = (uint64_t)std::min(cells, std::max(0.0f, cell.z));
+        codes[i] = Morton::encode(x, y, z);
+        order[i] = (uint32_t)i;
+    }
+
+    // 3. Sort the triangles along the curve
+    Morton::radixSort(codes, order, 3 * bitsPerAxis, parallel);
+
+    // 4. Emit the hierarchy from the sorted codes
+#ifdef BVH_PARALLEL_TASKS
+    #pragma omp parallel if(parallel)
+    #pragma omp single
+#endif
+    emit(bvh, primitives, codes, order, 0, primitives.size(), maxLeafSize, 0);
+}
+
+
+void LBVHBuilder::emit(BVH& node, const std::vector<BVHPrimitive>& primitives, const std::vector<uint64_t>& codes, const std::vector<uint32_t>& order, size_t begin, size_t end, size_t maxLeafSize, size_t depth) {
+    if (end - begin == 1) {
+        const BVHPrimitive& primitive = primitives[order[begin]];
+        node.box.cornerDown = primitive.cornerDown;
+        node.box.cornerUp = primitive.cornerUp;
+        node.box.add(primitive.mesh_index, primitive.triangle_index);
+        return;
+    }
+
+    // Split where the first differing bit of the range goes from 0 to 1.
+    // Identical codes, or a range too deep for the traversal stacks, are cut in half.
+    size_t middle = begin + (end - begin) / 2;
+    size_t remainingDepth = 0;
+    while (((size_t)1 << remainingDepth) < end - begin) remainingDepth++;
+    uint64_t difference = codes[begin] ^ codes[end - 1];
+    if (difference != 0 && depth + remainingDepth + 1 < BVH_MAX_DEPTH) {
+        int bit = highestBit(difference);
+        middle = std::partition_point(codes.begin() + begin, codes.begin() + end, [bit](uint64_t code) {
+            return ((code >> bit) & 1) == 0;
+        }) - codes.begin();
+        node.axis = 2 - bit % 3; // x is interleaved on the highest bit of each triplet
+    }
+    else node.axis = 0;
+    node.median = primitives[order[middle]].centroid[node.axis];
+
+    // SAH termination of the small ranges, their bounds are cheap to gather here
+    if (end - begin <= maxLeafSize) {
+        AABBox left, right;
+        left.setEmpty();
+        right.setEmpty();
+        for (size_t i = begin; i < middle; i++) left.extendTo(primitives[order[i]].cornerDown, primitives[order[i]].cornerUp);
+        for (size_t i = middle; i < end; i++) right.extendTo(primitives[order[i]].cornerDown, primitives[order[i]].cornerUp);
+        node.box.cornerDown = glm::min(left.cornerDown, right.cornerDown);
+        node.box.cornerUp = glm::max(left.cornerUp, right.cornerUp);
+        if (BVH::isLeafCheaper(node.box.area(), end - begin, left.area(), middle - begin, right.area(), end - middle)) {
+            node.axis = -1;
+            for (size_t i = begin; i < end; i++)
+                node.box.add(primitives[order[i]].mesh_index, primitives[order[i]].triangle_index);
+            return;
+        }
+    }
+
+    node.child_left = new BVH();
+    node.child_right = new BVH();
+#ifdef BVH_PARALLEL_TASKS
+    if (end - begin >= BVH_PARALLEL_TASK_SIZE && omp_in_parallel()) {
+        // The task only gets the child, a reference to the node would make it copy the node
+        BVH* left = node.child_left;
+        #pragma omp task shared(primitives, codes, order) firstprivate(left)
+        emit(*left, primitives, codes, order, begin, middle, maxLeafSize, depth + 1);
+        emit(*node.child_right, primitives, codes, order, middle, end, maxLeafSize, depth + 1);
+        #pragma omp taskwait
+    }
+    else
+#endif
+    {
+        emit(*node.child_left, primitives, codes, order, begin, middle, maxLeafSize, depth + 1);
+        emit(*node.child_right, primitives, codes, order, middle, end, maxLeafSize, depth + 1);
+    }
+
+    // The boxes are merged on the way up, the ranges are never scanned
+    node.box.cornerDown = glm::min(node.child_left->box.cornerDown, node.child_right->box.cornerDown);
+    node.box.cornerUp = glm::max(node.child_left->box.cornerUp, node.child_right->box.cornerUp);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <vector>
+#include <cstdint>
+
+#include "BVH.h"
+#include "Morton.h"
+
+
+/// Linear BVH builder: the triangles are sorted along a Morton curve of their centroids,
+/// then each node is split where the first bit of the codes of its range changes.
+/// Much faster than the SAH builder, for a somewhat lower quality tree, so meant for rebuilds while editing.
+class LBVHBuilder {
+
+public:
+    /// Builds the tree in 'bvh', which must be empty.
+    static void build(const std::vector<BVHPrimitive>& primitives, BVH& bvh, BVHMortonPrecision precision = BVHMortonPrecision::Bits30, size_t maxLeafSize = BVH_MAX_LEAF_SIZE);
+
+private:
+    static void emit(BVH& node, const std::vector<BVHPrimitive>& primitives, const std::vector<uint64_t>& codes, const std::vector<uint32_t>& order, size_t begin, size_t end, size_t maxLeafSize, size_t depth);
+};
@@ -0,0 +1,260 @@
+#include "LinearBVH.h"
+
+
+void LinearBVH::init(const std::shared_ptr<Scene> scenePtr, BVHSplitMethod splitMethod) {
+    // The pointer based tree is only needed during the construction
+    BVH bvh;
+    bvh.init(scenePtr, splitMethod);
+    init(scenePtr, bvh);
+}
+
+void LinearBVH::init(const std::shared_ptr<Scene>& scenePtr, const BVH& bvh) {
+    clear();
+    if(bvh.child_left == nullptr && bvh.box.triangles.empty()) return; // Empty scene
+
+    nodes.reserve(bvh.numOfNodes());
+    flatten(bvh);
+
+    // Prepare the triangles in leaf order
+    precomputeTriangles(scenePtr, triangles, precomputedTriangles);
+}
+
+void LinearBVH::clear() {
+    nodes.clear();
+    triangles.clear();
+    precomputedTriangles.clear();
+}
+
+void LinearBVH::precomputeTriangles(const std::shared_ptr<Scene>& scenePtr, const std::vector<LinearBVHTriangle>& triangles, std::vector<PrecomputedTriangle>& precomputedTriangles) {
+    const int numOfTriangles = (int)triangles.size();
+    precomputedTriangles.resize(numOfTriangles);
+    #pragma omp parallel for if(numOfTriangles >= (int)BVH_PARALLEL_NODE_SIZE)
+    for(int i = 0; i < numOfTriangles; i++) {
+        const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(triangles[i].mesh_index);
+        const glm::uvec3& triangleIndex = mesh->triangleIndices()[triangles[i].triangle_index];
+        const std::vector<glm::vec3>& positions = mesh->vertexPositions();
+        precomputedTriangles[i] = PrecomputedTriangle(positions[triangleIndex[0]], positions[triangleIndex[1]], positions[triangleIndex[2]]);
+    }
+}
+
+void LinearBVH::refit(const std::shared_ptr<Scene>& scenePtr) {
+    precomputeTriangles(scenePtr, triangles, precomputedTriangles);
+
+    // Children are stored after their parent, so a reverse sweep visits them first
+    for(size_t i = nodes.size(); i-- > 0;) {
+        LinearBVHNode& node = nodes[i];
+        if(node.numOfTriangles > 0) { // If it's a leaf
+            node.cornerDown = glm::vec3(std::numeric_limits<float>::max());
+            node.cornerUp = glm::vec3(std::numeric_limits<float>::lowest());
+            for(uint32_t k = node.trianglesOffset; k < node.trianglesOffset + node.numOfTriangles; k++)
+                BVH::extendToTriangle(scenePtr, triangles[k].mesh_index, triangles[k].triangle_index, node.cornerDown, node.cornerUp);
+            continue;
+        }
+        const LinearBVHNode& left = nodes[i + 1];
+        const LinearBVHNode& right = nodes[node.rightChildOffset];
+        node.cornerDown = glm::min(left.cornerDown, right.cornerDown);
+        node.cornerUp = glm::max(left.cornerUp, right.cornerUp);
+    }
+}
+
+float LinearBVH::computeSAHCost() const {
+    if(nodes.empty()) return 0.0f;
+    float rootArea = AABBox::area(nodes[0].cornerDown, nodes[0].cornerUp);
+    if(rootArea <= 0.0f) return 0.0f;
+
+    float cost = 0.0f;
+    for(const LinearBVHNode& node : nodes) {
+        float relativeArea = AABBox::area(node.cornerDown, node.cornerUp) / rootArea;
+        if(node.numOfTriangles > 0) cost += BVH_INTERSECTION_COST * node.numOfTriangles * relativeArea;
+        else cost += BVH_TRAVERSAL_COST * relativeArea;
+    }
+    return cost;
+}
+
+uint32_t LinearBVH::flatten(const BVH& bvh) {
+    uint32_t nodeIndex = (uint32_t)nodes.size();
+    nodes.emplace_back();
+    LinearBVHNode& node = nodes.back();
+    node.cornerDown = bvh.box.cornerDown;
+    node.cornerUp = bvh.box.cornerUp;
+    node.axis = (uint8_t)std::max(0, bvh.axis);
+    node.pad = 0;
+
+    if(bvh.child_left == nullptr) { // If it's a leaf
+        node.trianglesOffset = (uint32_t)triangles.size();
+        node.numOfTriangles = (uint16_t)bvh.box.triangles.size();
+        for(const std::pair<size_t, size_t>& pair : bvh.box.triangles)
+            triangles.push_back({ (uint32_t)pair.first, (uint32_t)pair.second });
+        return nodeIndex;
+    }
+
+    // The left child directly follows, only the right one needs to be stored
+    node.numOfTriangles = 0;
+    flatten(*bvh.child_left);
+    uint32_t rightChildOffset = flatten(*bvh.child_right);
+    nodes[nodeIndex].rightChildOffset = rightChildOffset; // The vector may have been reallocated
+    return nodeIndex;
+}
+
+
+bool LinearBVH::intersect(RayHit& rayHit, const Ray& ray, size_t& mesh_index, size_t& triangle_index) const {
+    if(nodes.empty()) return false;
+    const LinearBVHNode* nodesPtr = nodes.data();
+    const PrecomputedTriangle* trianglesPtr = precomputedTriangles.data();
+
+    float tmin = 0;
+    if(!AABBox::intersect(nodesPtr[0].cornerDown, nodesPtr[0].cornerUp, ray, tmin)) return false;
+
+    // Nodes still to visit, with the distance at which the ray enters them
+    struct StackEntry {
+        uint32_t node;
+        float tmin;
+    };
+    StackEntry stack[BVH_MAX_DEPTH];
+    size_t stackSize = 0;
+    stack[stackSize++] = { 0, tmin };
+
+    uint32_t hitTriangle = 0;
+    bool hit = false;
+    while(stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+        // To optimize (so that we do not check useless boxes)
+        if(entry.tmin >= rayHit.t) // This means that we won't find a closer intersection
+            continue;
+
+        const LinearBVHNode& node = nodesPtr[entry.node];
+        if(node.numOfTriangles > 0) { // If it's a leaf
+            size_t hitIndex = 0;
+            if(PrecomputedTriangle::intersect(trianglesPtr + node.trianglesOffset, node.numOfTriangles, rayHit, ray, hitIndex)) {
+                hitTriangle = node.trianglesOffset + (uint32_t)hitIndex;
+                hit = true;
+            }
+            continue;
+        }
+
+        // We now check with childs, the closest one is pushed last to be visited first
+        uint32_t left = entry.node + 1;
+        uint32_t right = node.rightChildOffset;
+        float tminLeft = 0;
+        bool intersectLeft = AABBox::intersect(nodesPtr[left].cornerDown, nodesPtr[left].cornerUp, ray, tminLeft);
+        float tminRight = 0;
+        bool intersectRight = AABBox::intersect(nodesPtr[right].cornerDown, nodesPtr[right].cornerUp, ray, tminRight);
+
+        if(intersectLeft && intersectRight) {
+            if(tminRight < tminLeft) {
+                stack[stackSize++] = { left, tminLeft };
+                stack[stackSize++] = { right, tminRight };
+            }
+            else {
+                stack[stackSize++] = { right, tminRight };
+                stack[stackSize++] = { left, tminLeft };
+            }
+        }
+        else if(intersectLeft)  stack[stackSize++] = { left, tminLeft };
+        else if(intersectRight) stack[stackSize++] = { right, tminRight };
+    }
+
+    // The indices in the scene are only needed for the closest triangle
+    if(hit) {
+        mesh_index = triangles[hitTriangle].mesh_index;
+        triangle_index = triangles[hitTriangle].triangle_index;
+    }
+    return hit;
+}
+
+
+bool LinearBVH::fastIntersect(const Ray& ray, float tmin, float tmax) const {
+    if(nodes.empty()) return false;
+    const LinearBVHNode* nodesPtr = nodes.data();
+    const PrecomputedTriangle* trianglesPtr = precomputedTriangles.data();
+
+    if(!AABBox::overlaps(nodesPtr[0].cornerDown, nodesPtr[0].cornerUp, ray, tmin, tmax)) return false;
+
+    uint32_t stack[BVH_MAX_DEPTH];
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while(stackSize > 0) {
+        uint32_t nodeIndex = stack[--stackSize];
+        const LinearBVHNode& node = nodesPtr[nodeIndex];
+        if(node.numOfTriangles > 0) { // If it's a leaf
+            if(PrecomputedTriangle::fastIntersect(trianglesPtr + node.trianglesOffset, node.numOfTriangles, ray, tmin, tmax)) return true; // Any hit will do
+            continue;
+        }
+
+        // No distances to sort: the child on the side of the origin along the split axis is visited first,
+        // the occluders close to the origin being the most likely ones
+        uint32_t nearChild = nodeIndex + 1;
+        uint32_t farChild = node.rightChildOffset;
+        if(ray.direction[node.axis] < 0) std::swap(nearChild, farChild);
+        if(AABBox::overlaps(nodesPtr[farChild].cornerDown, nodesPtr[farChild].cornerUp, ray, tmin, tmax))
+            stack[stackSize++] = farChild;
+        if(AABBox::overlaps(nodesPtr[nearChild].cornerDown, nodesPtr[nearChild].cornerUp, ray, tmin, tmax))
+            stack[stackSize++] = nearChild;
+    }
+    return false;
+}
+
+void LinearBVH::intersect(RayPacket& packet) const {
+    if(nodes.empty() || packet.size == 0) return;
+    const LinearBVHNode* nodesPtr = nodes.data();
+    const PrecomputedTriangle* trianglesPtr = precomputedTriangles.data();
+
+    // Nodes still to visit, with the first ray which may enter them: the rays before it missed one of their ancestors
+    struct StackEntry {
+        uint32_t node;
+        uint32_t firstRay;
+    };
+    StackEntry stack[BVH_MAX_DEPTH];
+    size_t stackSize = 0;
+    stack[stackSize++] = { 0, 0 };
+
+    float maxDistance = packet.maxDistance();
+    uint32_t hitTriangles[RAY_PACKET_SIZE];
+    bool hits[RAY_PACKET_SIZE] = {};
+    while(stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+        const LinearBVHNode& node = nodesPtr[entry.node];
+        // One test culls the node for the whole packet
+        if(!packet.mayIntersect(node.cornerDown, node.cornerUp, maxDistance)) continue;
+
+        // Otherwise the node is entered as soon as one ray enters it
+        uint32_t first = entry.firstRay;
+        float tmin = 0;
+        while(first < packet.size && !(AABBox::intersect(node.cornerDown, node.cornerUp, packet.rays[first], tmin) && tmin < packet.rayHits[first].t))
+            first++;
+        if(first == packet.size) continue;
+
+        if(node.numOfTriangles > 0) { // If it's a leaf
+            for(uint32_t i = first; i < packet.size; i++) {
+                if(i > first && !(AABBox::intersect(node.cornerDown, node.cornerUp, packet.rays[i], tmin) && tmin < packet.rayHits[i].t))
+                    continue;
+                size_t hitIndex = 0;
+                if(PrecomputedTriangle::intersect(trianglesPtr + node.trianglesOffset, node.numOfTriangles, packet.rayHits[i], packet.rays[i], hitIndex)) {
+                    hitTriangles[i] = node.trianglesOffset + (uint32_t)hitIndex;
+                    hits[i] = true;
+                }
+            }
+            maxDistance = packet.maxDistance();
+            continue;
+        }
+
+        // The directions of the packet share their sign, the child on their side of the split is visited first
+        uint32_t left = entry.node + 1;
+        uint32_t right = node.rightChildOffset;
+        if(packet.rays[first].direction[node.axis] < 0) {
+            stack[stackSize++] = { left, first };
+            stack[stackSize++] = { right, first };
+        }
+        else {
+            stack[stackSize++] = { right, first };
+            stack[stackSize++] = { left, first };
+        }
+    }
+
+    for(size_t i = 0; i < packet.size; i++) {
+        if(!hits[i]) continue;
+        packet.hit[i] = true;
+        packet.triangle_index[i] = triangles[hitTriangles[i]].triangle_index;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <vector>
+#include <cstdint>
+
+#include "AABBox.h"
+#include "BVH.h"
+#include "PrecomputedTriangle.h"
+#include "RayPacket.h"
+#include "../Ray.h"
+#include "../Scene.h"
+
+
+/// Node of the flattened BVH. The nodes are stored in depth first order,
+/// so the left child of an internal node is the node right after it.
+struct LinearBVHNode {
+    glm::vec3 cornerDown;
+    union {
+        uint32_t trianglesOffset;  // Leaf: first triangle in LinearBVH::triangles
+        uint32_t rightChildOffset; // Internal node: index of the right child
+    };
+    glm::vec3 cornerUp;
+    uint16_t numOfTriangles;       // 0 for an internal node
+    uint8_t axis;
+    uint8_t pad;
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should fit in half a cache line");
+
+struct LinearBVHTriangle {
+    uint32_t mesh_index;
+    uint32_t triangle_index;
+};
+
+
+/// BVH compacted into a single node array, built by flattening a BVH.
+class LinearBVH {
+
+public:
+    LinearBVH() {};
+    void init(const std::shared_ptr<Scene> scenePtr, BVHSplitMethod splitMethod = BVHSplitMethod::SAH);
+    void init(const std::shared_ptr<Scene>& scenePtr, const BVH& bvh);
+    void clear();
+    /// Updates the triangles and the boxes after the vertices of the meshes moved, the nodes are kept.
+    void refit(const std::shared_ptr<Scene>& scenePtr);
+
+    bool intersect(RayHit& rayHit, const Ray& ray, size_t& mesh_index, size_t& triangle_index) const;
+    /// Any hit at a distance in [tmin, tmax).
+    bool fastIntersect(const Ray& ray, float tmin = 0.0f, float tmax = std::numeric_limits<float>::max()) const;
+    /// Closest hits of a coherent packet, the rays sharing the node fetches. Each ray is traced up to 'packet.rayHits[i].t'
+    /// and the ones hitting a closer triangle get it in 'packet.triangle_index'.
+    void intersect(RayPacket& packet) const;
+
+    /// SAH cost of the nodes, relative to the surface of the root box.
+    float computeSAHCost() const;
+    inline size_t numOfNodes() const { return nodes.size(); }
+    inline size_t memoryUsage() const { return nodes.size() * sizeof(LinearBVHNode) + triangles.size() * (sizeof(LinearBVHTriangle) + sizeof(PrecomputedTriangle)); }
+
+    std::vector<LinearBVHNode> nodes;
+    std::vector<LinearBVHTriangle> triangles;
+    std::vector<PrecomputedTriangle> precomputedTriangles; // In the order of 'triangles', so leaves never go through the meshes
+
+    /// Fills 'precomputedTriangles' from the current vertices, in the order of 'triangles'.
+    static void precomputeTriangles(const std::shared_ptr<Scene>& scenePtr, const std::vector<LinearBVHTriangle>& triangles, std::vector<PrecomputedTriangle>& precomputedTriangles);
+
+private:
+    uint32_t flatten(const BVH& bvh);
+};
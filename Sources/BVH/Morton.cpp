@@ -0,0 +1,57 @@
+#include "Morton.h"
+
+#include <omp.h>
+
+
+void Morton::radixSort(std::vector<uint64_t>& codes, std::vector<uint32_t>& order, int bits, bool parallel) {
+    // Least significant digit first, 8 bits per pass. Each thread counts then scatters its own chunk,
+    // so the sort stays stable and the result does not depend on the number of threads.
+    const size_t size = codes.size();
+    std::vector<uint64_t> sortedCodes(size);
+    std::vector<uint32_t> sortedOrder(size);
+    std::vector<size_t> histograms(256 * omp_get_max_threads());
+
+    for (int shift = 0; shift < bits; shift += 8) {
+        bool skip = false;
+        #pragma omp parallel if(parallel)
+        {
+            const size_t numOfThreads = omp_get_num_threads();
+            const size_t thread = omp_get_thread_num();
+            const size_t chunkBegin = size * thread / numOfThreads;
+            const size_t chunkEnd = size * (thread + 1) / numOfThreads;
+            size_t* histogram = &histograms[256 * thread];
+
+            for (size_t d = 0; d < 256; d++) histogram[d] = 0;
+            for (size_t i = chunkBegin; i < chunkEnd; i++)
+                histogram[(codes[i] >> shift) & 0xff]++;
+            #pragma omp barrier
+
+            // Offsets of every thread for every digit: digit major, then thread order
+            #pragma omp single
+            {
+                size_t offset = 0;
+                for (size_t d = 0; d < 256; d++) {
+                    size_t digitCount = 0;
+                    for (size_t t = 0; t < numOfThreads; t++) {
+                        size_t count = histograms[256 * t + d];
+                        histograms[256 * t + d] = offset;
+                        offset += count;
+                        digitCount += count;
+                    }
+                    if (digitCount == size) skip = true; // All the codes share this digit
+                }
+            }
+
+            if (!skip) {
+                for (size_t i = chunkBegin; i < chunkEnd; i++) {
+                    size_t destination = histogram[(codes[i] >> shift) & 0xff]++;
+                    sortedCodes[destination] = codes[i];
+                    sortedOrder[destination] = order[i];
+                }
+            }
+        }
+        if (skip) continue;
+        codes.swap(sortedCodes);
+        order.swap(sortedOrder);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <vector>
+#include <cstdint>
+
+
+/// Morton codes interleave the bits of the coordinates of a grid cell, so that sorting them
+/// brings close cells together. Used to order the triangles of the LBVH builder and the rays of RaySorter.
+class Morton {
+
+public:
+    /// Spreads the 21 lowest bits of 'x' so that two zeros separate each of them.
+    static inline uint64_t expandBits(uint64_t x) {
+        x &= 0x1fffff;
+        x = (x | x << 32) & 0x1f00000000ffffull;
+        x = (x | x << 16) & 0x1f0000ff0000ffull;
+        x = (x | x << 8)  & 0x100f00f00f00f00full;
+        x = (x | x << 4)  & 0x10c30c30c30c30c3ull;
+        x = (x | x << 2)  & 0x1249249249249249ull;
+        return x;
+    }
+
+    /// Code of the cell (x, y, z), x y z interleaved from the highest bit.
+    static inline uint64_t encode(uint64_t x, uint64_t y, uint64_t z) { return (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z); }
+
+    /// Stable sort of the 'bits' lowest bits of 'codes', 'order' being moved along.
+    static void radixSort(std::vector<uint64_t>& codes, std::vector<uint32_t>& order, int bits, bool parallel);
+};
@@ -0,0 +1,249 @@
+#include "PrecomputedTriangle.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PRECOMPUTED_TRIANGLE_SSE
+#include <immintrin.h>
+#endif
+
+
+PrecomputedTriangle::PrecomputedTriangle(const glm::vec3& p0_, const glm::vec3& p1, const glm::vec3& p2) :
+    p0(p0_),
+    e0(p1 - p0_),
+    e1(p2 - p0_)
+{
+    n = glm::cross(e0, e1);
+}
+
+// Moller-Trumbore rewritten with the precomputed normal:
+// with s = o - p0 and r = d x s, a = -d.n, b0 = -e1.r / a, b1 = e0.r / a and t = s.n / a.
+// The tests are done on the scaled values, the division only happens for an actual hit.
+
+bool PrecomputedTriangle::intersect(RayHit& rayHit, const Ray& ray) const {
+    float a = -glm::dot(ray.direction, n);
+    if (!(a >= PRECOMPUTED_TRIANGLE_EPSILON)) // Back facing or parallel to the ray
+        return false;
+
+    glm::vec3 s = ray.origin - p0;
+    glm::vec3 r = glm::cross(ray.direction, s);
+    float u = -glm::dot(e1, r);
+    float v = glm::dot(e0, r);
+    if ((u < 0) || (v < 0) || (u + v > a))
+        return false;
+
+    float t = glm::dot(s, n);
+    if (t < 0)
+        return false;
+
+    float invA = 1.0f / a;
+    t *= invA;
+    if (t >= rayHit.t)
+        return false;
+
+    rayHit.b0 = u * invA;
+    rayHit.b1 = v * invA;
+    rayHit.b2 = 1 - rayHit.b0 - rayHit.b1;
+    rayHit.t = t;
+    return true;
+}
+
+bool PrecomputedTriangle::fastIntersect(const Ray& ray, float tmin, float tmax) const {
+    float a = -glm::dot(ray.direction, n);
+    if (!(a >= PRECOMPUTED_TRIANGLE_EPSILON))
+        return false;
+
+    glm::vec3 s = ray.origin - p0;
+    glm::vec3 r = glm::cross(ray.direction, s);
+    float u = -glm::dot(e1, r);
+    float v = glm::dot(e0, r);
+    if ((u < 0) || (v < 0) || (u + v > a))
+        return false;
+
+    // Compared with the bounds scaled by a, which is positive
+    float t = glm::dot(s, n);
+    return (t >= tmin * a) && (t < tmax * a);
+}
+
+
+namespace {
+
+#ifdef PRECOMPUTED_TRIANGLE_SSE
+/// Scaled barycentrics, distances and denominators of a group of triangles, one lane per triangle.
+struct alignas(32) Lanes {
+    float u[8];
+    float v[8];
+    float t[8];
+    float a[8];
+};
+
+/// Turns the lanes set in 'mask' into the closest hit, the scaled tests already rejected the obvious misses.
+inline bool resolveHits(const Lanes& lanes, unsigned int mask, size_t offset, RayHit& rayHit, size_t& hitIndex) {
+    bool hit = false;
+    for (size_t i = 0; mask != 0; i++, mask >>= 1) {
+        if (!(mask & 1u)) continue;
+        float invA = 1.0f / lanes.a[i];
+        float t = lanes.t[i] * invA;
+        if (t >= rayHit.t) continue;
+        rayHit.b0 = lanes.u[i] * invA;
+        rayHit.b1 = lanes.v[i] * invA;
+        rayHit.b2 = 1 - rayHit.b0 - rayHit.b1;
+        rayHit.t = t;
+        hitIndex = offset + i;
+        hit = true;
+    }
+    return hit;
+}
+
+/// Four consecutive triangles with one SSE test. The records are transposed to structure of arrays on the fly.
+inline unsigned int intersect4(const PrecomputedTriangle* triangles, const __m128 (&origin)[3], const __m128 (&direction)[3], float tmin, float tmax, Lanes& lanes) {
+    // c[k] is the k-th float of the four records: p0, e0, e1 then n
+    __m128 c[12];
+    const float* base = &triangles[0].p0.x;
+    for (int j = 0; j < 3; j++) {
+        __m128 r0 = _mm_loadu_ps(base + 4 * j);
+        __m128 r1 = _mm_loadu_ps(base + 12 + 4 * j);
+        __m128 r2 = _mm_loadu_ps(base + 24 + 4 * j);
+        __m128 r3 = _mm_loadu_ps(base + 36 + 4 * j);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        c[4 * j] = r0;
+        c[4 * j + 1] = r1;
+        c[4 * j + 2] = r2;
+        c[4 * j + 3] = r3;
+    }
+
+    __m128 sx = _mm_sub_ps(origin[0], c[0]);
+    __m128 sy = _mm_sub_ps(origin[1], c[1]);
+    __m128 sz = _mm_sub_ps(origin[2], c[2]);
+    __m128 rx = _mm_sub_ps(_mm_mul_ps(direction[1], sz), _mm_mul_ps(direction[2], sy));
+    __m128 ry = _mm_sub_ps(_mm_mul_ps(direction[2], sx), _mm_mul_ps(direction[0], sz));
+    __m128 rz = _mm_sub_ps(_mm_mul_ps(direction[0], sy), _mm_mul_ps(direction[1], sx));
+
+    __m128 dn = _mm_add_ps(_mm_add_ps(_mm_mul_ps(direction[0], c[9]), _mm_mul_ps(direction[1], c[10])), _mm_mul_ps(direction[2], c[11]));
+    __m128 a = _mm_sub_ps(_mm_setzero_ps(), dn);
+    __m128 e1r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[6], rx), _mm_mul_ps(c[7], ry)), _mm_mul_ps(c[8], rz));
+    __m128 u = _mm_sub_ps(_mm_setzero_ps(), e1r);
+    __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[3], rx), _mm_mul_ps(c[4], ry)), _mm_mul_ps(c[5], rz));
+    __m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, c[9]), _mm_mul_ps(sy, c[10])), _mm_mul_ps(sz, c[11]));
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 valid = _mm_cmpge_ps(a, _mm_set1_ps(PRECOMPUTED_TRIANGLE_EPSILON));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), a));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(t, _mm_mul_ps(_mm_set1_ps(tmin), a)));
+    valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_mul_ps(_mm_set1_ps(tmax), a)));
+
+    _mm_store_ps(lanes.u, u);
+    _mm_store_ps(lanes.v, v);
+    _mm_store_ps(lanes.t, t);
+    _mm_store_ps(lanes.a, a);
+    return (unsigned int)_mm_movemask_ps(valid);
+}
+
+#ifdef __AVX__
+/// Eight consecutive triangles with one AVX test, the low and high halves hold triangles 0-3 and 4-7.
+inline unsigned int intersect8(const PrecomputedTriangle* triangles, const __m256 (&origin)[3], const __m256 (&direction)[3], float tmin, float tmax, Lanes& lanes) {
+    __m256 c[12];
+    const float* base = &triangles[0].p0.x;
+    for (int j = 0; j < 3; j++) {
+        __m256 r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(base + 4 * j)),      _mm_loadu_ps(base + 48 + 4 * j), 1);
+        __m256 r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(base + 12 + 4 * j)), _mm_loadu_ps(base + 60 + 4 * j), 1);
+        __m256 r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(base + 24 + 4 * j)), _mm_loadu_ps(base + 72 + 4 * j), 1);
+        __m256 r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(base + 36 + 4 * j)), _mm_loadu_ps(base + 84 + 4 * j), 1);
+        // 4x4 transpose within each half
+        __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+        __m256 t1 = _mm256_unpacklo_ps(r2, r3);
+        __m256 t2 = _mm256_unpackhi_ps(r0, r1);
+        __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+        c[4 * j]     = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+        c[4 * j + 1] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+        c[4 * j + 2] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        c[4 * j + 3] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    }
+
+    __m256 sx = _mm256_sub_ps(origin[0], c[0]);
+    __m256 sy = _mm256_sub_ps(origin[1], c[1]);
+    __m256 sz = _mm256_sub_ps(origin[2], c[2]);
+    __m256 rx = _mm256_sub_ps(_mm256_mul_ps(direction[1], sz), _mm256_mul_ps(direction[2], sy));
+    __m256 ry = _mm256_sub_ps(_mm256_mul_ps(direction[2], sx), _mm256_mul_ps(direction[0], sz));
+    __m256 rz = _mm256_sub_ps(_mm256_mul_ps(direction[0], sy), _mm256_mul_ps(direction[1], sx));
+
+    __m256 dn = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(direction[0], c[9]), _mm256_mul_ps(direction[1], c[10])), _mm256_mul_ps(direction[2], c[11]));
+    __m256 a = _mm256_sub_ps(_mm256_setzero_ps(), dn);
+    __m256 e1r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[6], rx), _mm256_mul_ps(c[7], ry)), _mm256_mul_ps(c[8], rz));
+    __m256 u = _mm256_sub_ps(_mm256_setzero_ps(), e1r);
+    __m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[3], rx), _mm256_mul_ps(c[4], ry)), _mm256_mul_ps(c[5], rz));
+    __m256 t = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, c[9]), _mm256_mul_ps(sy, c[10])), _mm256_mul_ps(sz, c[11]));
+
+    __m256 zero = _mm256_setzero_ps();
+    __m256 valid = _mm256_cmp_ps(a, _mm256_set1_ps(PRECOMPUTED_TRIANGLE_EPSILON), _CMP_GE_OQ);
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), a, _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_mul_ps(_mm256_set1_ps(tmin), a), _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_mul_ps(_mm256_set1_ps(tmax), a), _CMP_LT_OQ));
+
+    _mm256_store_ps(lanes.u, u);
+    _mm256_store_ps(lanes.v, v);
+    _mm256_store_ps(lanes.t, t);
+    _mm256_store_ps(lanes.a, a);
+    return (unsigned int)_mm256_movemask_ps(valid);
+}
+#endif
+#endif
+
+}
+
+
+bool PrecomputedTriangle::intersect(const PrecomputedTriangle* triangles, size_t count, RayHit& rayHit, const Ray& ray, size_t& hitIndex) {
+    bool hit = false;
+    size_t i = 0;
+#ifdef PRECOMPUTED_TRIANGLE_SSE
+    if (count >= 4) {
+        Lanes lanes;
+#ifdef __AVX__
+        __m256 origin8[3] = { _mm256_set1_ps(ray.origin.x), _mm256_set1_ps(ray.origin.y), _mm256_set1_ps(ray.origin.z) };
+        __m256 direction8[3] = { _mm256_set1_ps(ray.direction.x), _mm256_set1_ps(ray.direction.y), _mm256_set1_ps(ray.direction.z) };
+        for (; i + 8 <= count; i += 8) {
+            unsigned int mask = intersect8(triangles + i, origin8, direction8, 0.0f, rayHit.t, lanes);
+            if (mask) hit |= resolveHits(lanes, mask, i, rayHit, hitIndex);
+        }
+#endif
+        __m128 origin[3] = { _mm_set1_ps(ray.origin.x), _mm_set1_ps(ray.origin.y), _mm_set1_ps(ray.origin.z) };
+        __m128 direction[3] = { _mm_set1_ps(ray.direction.x), _mm_set1_ps(ray.direction.y), _mm_set1_ps(ray.direction.z) };
+        for (; i + 4 <= count; i += 4) {
+            unsigned int mask = intersect4(triangles + i, origin, direction, 0.0f, rayHit.t, lanes);
+            if (mask) hit |= resolveHits(lanes, mask, i, rayHit, hitIndex);
+        }
+    }
+#endif
+    // Remaining triangles one by one
+    for (; i < count; i++) {
+        if (triangles[i].intersect(rayHit, ray)) {
+            hitIndex = i;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+bool PrecomputedTriangle::fastIntersect(const PrecomputedTriangle* triangles, size_t count, const Ray& ray, float tmin, float tmax) {
+    size_t i = 0;
+#ifdef PRECOMPUTED_TRIANGLE_SSE
+    if (count >= 4) {
+        Lanes lanes;
+#ifdef __AVX__
+        __m256 origin8[3] = { _mm256_set1_ps(ray.origin.x), _mm256_set1_ps(ray.origin.y), _mm256_set1_ps(ray.origin.z) };
+        __m256 direction8[3] = { _mm256_set1_ps(ray.direction.x), _mm256_set1_ps(ray.direction.y), _mm256_set1_ps(ray.direction.z) };
+        for (; i + 8 <= count; i += 8)
+            if (intersect8(triangles + i, origin8, direction8, tmin, tmax, lanes)) return true;
+#endif
+        __m128 origin[3] = { _mm_set1_ps(ray.origin.x), _mm_set1_ps(ray.origin.y), _mm_set1_ps(ray.origin.z) };
+        __m128 direction[3] = { _mm_set1_ps(ray.direction.x), _mm_set1_ps(ray.direction.y), _mm_set1_ps(ray.direction.z) };
+        for (; i + 4 <= count; i += 4)
+            if (intersect4(triangles + i, origin, direction, tmin, tmax, lanes)) return true;
+    }
+#endif
+    for (; i < count; i++)
+        if (triangles[i].fastIntersect(ray, tmin, tmax)) return true;
+    return false;
+}
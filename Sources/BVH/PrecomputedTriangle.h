@@ -0,0 +1,39 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <vector>
+#include <limits>
+
+#include "../Ray.h"
+
+
+static const float PRECOMPUTED_TRIANGLE_EPSILON (0.0000000001f); // Same threshold as Ray::intersect
+
+/// Triangle prepared for the intersection test: the edges and the normal are computed once,
+/// so a candidate costs one cross product and a few dot products, without square root nor division.
+/// The hits (t and barycentrics) are the same as the ones of Ray::intersect.
+struct PrecomputedTriangle {
+    glm::vec3 p0;
+    glm::vec3 e0; // p1 - p0
+    glm::vec3 e1; // p2 - p0
+    glm::vec3 n;  // cross(e0, e1), not normalized
+
+    PrecomputedTriangle() {};
+    PrecomputedTriangle(const glm::vec3& p0_, const glm::vec3& p1, const glm::vec3& p2);
+
+    bool intersect(RayHit& rayHit, const Ray& ray) const;
+    /// Any hit at a distance in [tmin, tmax).
+    bool fastIntersect(const Ray& ray, float tmin = 0.0f, float tmax = std::numeric_limits<float>::max()) const;
+
+    /// Closest hit among 'count' consecutive triangles, tested 4 or 8 at a time when SIMD is available.
+    /// 'hitIndex' is relative to 'triangles'.
+    static bool intersect(const PrecomputedTriangle* triangles, size_t count, RayHit& rayHit, const Ray& ray, size_t& hitIndex);
+    static bool fastIntersect(const PrecomputedTriangle* triangles, size_t count, const Ray& ray, float tmin = 0.0f, float tmax = std::numeric_limits<float>::max());
+};
+static_assert(sizeof(PrecomputedTriangle) == 12 * sizeof(float), "PrecomputedTriangle should be tightly packed");
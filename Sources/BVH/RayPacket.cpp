@@ -0,0 +1,63 @@
+#include "RayPacket.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+void RayPacket::init() {
+    for (size_t i = 0; i < size; i++) {
+        rayHits[i] = RayHit(0, 0, 0, std::numeric_limits<float>::max());
+        hit[i] = false;
+        instance_index[i] = 0;
+        triangle_index[i] = 0;
+    }
+    computeBounds();
+}
+
+void RayPacket::computeBounds() {
+    originMin = glm::vec3(std::numeric_limits<float>::max());
+    originMax = glm::vec3(std::numeric_limits<float>::lowest());
+    invDirMin = glm::vec3(std::numeric_limits<float>::max());
+    invDirMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for (size_t i = 0; i < size; i++) {
+        originMin = glm::min(originMin, rays[i].origin);
+        originMax = glm::max(originMax, rays[i].origin);
+        invDirMin = glm::min(invDirMin, rays[i].inv_dir);
+        invDirMax = glm::max(invDirMax, rays[i].inv_dir);
+    }
+
+    // A direction parallel to an axis (infinite inverse) or a sign change makes the intervals useless
+    coherent = size > 0;
+    for (int a = 0; a < 3; a++) {
+        if (!std::isfinite(invDirMin[a]) || !std::isfinite(invDirMax[a]) || (invDirMin[a] < 0) != (invDirMax[a] < 0))
+            coherent = false;
+    }
+}
+
+// Interval arithmetic on the slab method: along each axis, the entry and exit distances of all the rays
+// are within the products of the interval from the origins to the planes and the interval of the inverse directions.
+
+bool RayPacket::mayIntersect(const glm::vec3& cornerDown, const glm::vec3& cornerUp, float tmax) const {
+    float entry = 0.0f; // Lower bound of the distance at which any ray enters the box
+    float exit = tmax;  // Upper bound of the distance at which any ray leaves it
+    for (int a = 0; a < 3; a++) {
+        const bool positive = invDirMin[a] >= 0;
+        const float near = positive ? cornerDown[a] : cornerUp[a];
+        const float far = positive ? cornerUp[a] : cornerDown[a];
+
+        // The origins vary between originMin and originMax, the inverse directions between invDirMin and invDirMax
+        const float nearLow = near - originMax[a];
+        const float nearHigh = near - originMin[a];
+        entry = std::max(entry, std::min(std::min(nearLow * invDirMin[a], nearLow * invDirMax[a]), std::min(nearHigh * invDirMin[a], nearHigh * invDirMax[a])));
+        const float farLow = far - originMax[a];
+        const float farHigh = far - originMin[a];
+        exit = std::min(exit, std::max(std::max(farLow * invDirMin[a], farLow * invDirMax[a]), std::max(farHigh * invDirMin[a], farHigh * invDirMax[a])));
+    }
+    return entry <= exit;
+}
+
+float RayPacket::maxDistance() const {
+    float distance = 0.0f;
+    for (size_t i = 0; i < size; i++) distance = std::max(distance, rayHits[i].t);
+    return distance;
+}
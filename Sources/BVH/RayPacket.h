@@ -0,0 +1,49 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <limits>
+#include <cstddef>
+
+#include "../Ray.h"
+#include "../RayHit.h"
+
+
+static const size_t RAY_PACKET_WIDTH (4); // Packets cover squares of RAY_PACKET_WIDTH pixels
+static const size_t RAY_PACKET_SIZE (RAY_PACKET_WIDTH * RAY_PACKET_WIDTH);
+
+/// Up to RAY_PACKET_SIZE rays traced together, with the closest hit of each of them.
+/// The packet is bounded by the intervals of the origins and of the inverse directions of its rays,
+/// so that a node can be skipped for all the rays at once.
+struct RayPacket {
+    Ray rays[RAY_PACKET_SIZE];
+    size_t size = 0;
+
+    // Results, filled by the traversals. 'rayHits' also hold the distance up to which each ray is traced.
+    RayHit rayHits[RAY_PACKET_SIZE];
+    bool hit[RAY_PACKET_SIZE];
+    size_t instance_index[RAY_PACKET_SIZE];
+    size_t triangle_index[RAY_PACKET_SIZE];
+
+    // Bounds of the rays, set by computeBounds
+    glm::vec3 originMin;
+    glm::vec3 originMax;
+    glm::vec3 invDirMin;
+    glm::vec3 invDirMax;
+    bool coherent = false; // The directions have the same sign along each axis, required by the culling
+
+    /// To call once the rays are set. Resets the hits.
+    void init();
+    /// To call after the rays changed (to another space), the hits are kept.
+    void computeBounds();
+
+    /// Conservative test: false only if no ray of the packet enters the box before 'tmax'.
+    /// Only meaningful for a coherent packet.
+    bool mayIntersect(const glm::vec3& cornerDown, const glm::vec3& cornerUp, float tmax) const;
+    float maxDistance() const;
+};
@@ -0,0 +1,34 @@
+#include "RaySorter.h"
+
+#include <omp.h>
+#include <algorithm>
+
+
+void RaySorter::sort(const ShadowRay* shadowRays, std::vector<uint32_t>& indices, bool parallel) {
+    const int numOfRays = (int)indices.size();
+    if (numOfRays < 2) return;
+
+    glm::vec3 originMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 originMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for (uint32_t index : indices) {
+        originMin = glm::min(originMin, shadowRays[index].ray.origin);
+        originMax = glm::max(originMax, shadowRays[index].ray.origin);
+    }
+
+    // Octant above the Morton code, so that the rays of an octant stay together
+    const float cells = (float)((1 << RAY_SORT_BITS_PER_AXIS) - 1);
+    const glm::vec3 extent = originMax - originMin;
+    const glm::vec3 scale = glm::vec3(extent.x > 0.0f ? cells / extent.x : 0.0f, extent.y > 0.0f ? cells / extent.y : 0.0f, extent.z > 0.0f ? cells / extent.z : 0.0f);
+    std::vector<uint64_t> codes(numOfRays);
+    #pragma omp parallel for schedule(static) if(parallel)
+    for (int i = 0; i < numOfRays; i++) {
+        const Ray& ray = shadowRays[indices[i]].ray;
+        glm::vec3 cell = (ray.origin - originMin) * scale;
+        uint64_t x = (uint64_t)std::min(cells, std::max(0.0f, cell.x));
+        uint64_t y = (uint64_t)std::min(cells, std::max(0.0f, cell.y));
+        uint64_t z = (uint64_t)std::min(cells, std::max(0.0f, cell.z));
+        uint64_t octant = (ray.direction.x < 0.0f ? 4 : 0) | (ray.direction.y < 0.0f ? 2 : 0) | (ray.direction.z < 0.0f ? 1 : 0);
+        codes[i] = (octant << (3 * RAY_SORT_BITS_PER_AXIS)) | Morton::encode(x, y, z);
+    }
+    Morton::radixSort(codes, indices, 3 * RAY_SORT_BITS_PER_AXIS + 3, parallel);
+}
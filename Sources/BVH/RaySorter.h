@@ -0,0 +1,27 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <vector>
+#include <cstdint>
+
+#include "Morton.h"
+#include "../Ray.h"
+
+
+static const int RAY_SORT_BITS_PER_AXIS (10); // Of the Morton grid of the origins, the octant of the direction adding 3 bits
+
+/// Reordering of incoherent rays before their traversal. Rays going to the same octant from close origins
+/// visit mostly the same nodes, so tracing them one after the other keeps these nodes in the caches.
+class RaySorter {
+
+public:
+    /// Sorts 'indices', which refer to 'shadowRays', by octant of the direction then along a Morton curve
+    /// of the origins, laid out between the bounds of the origins.
+    static void sort(const ShadowRay* shadowRays, std::vector<uint32_t>& indices, bool parallel);
+};
@@ -0,0 +1,326 @@
+#include "SBVH.h"
+
+#include <omp.h>
+
+
+/// Extends a box without the triangle list of AABBox, the nodes only need the corners.
+inline void extend(glm::vec3& cornerDown, glm::vec3& cornerUp, const glm::vec3& point) {
+    cornerDown = glm::min(cornerDown, point);
+    cornerUp = glm::max(cornerUp, point);
+}
+
+inline float overlapArea(const AABBox& a, const AABBox& b) {
+    glm::vec3 cornerDown = glm::max(a.cornerDown, b.cornerDown);
+    glm::vec3 cornerUp = glm::min(a.cornerUp, b.cornerUp);
+    if (cornerDown.x > cornerUp.x || cornerDown.y > cornerUp.y || cornerDown.z > cornerUp.z) return 0.0f;
+    return AABBox::area(cornerDown, cornerUp);
+}
+
+
+void SBVHBuilder::build(const std::shared_ptr<Scene>& scenePtr, std::vector<BVHPrimitive>& primitives, BVH& bvh, float memoryBudget, size_t maxLeafSize) {
+    if (primitives.empty()) return;
+
+    AABBox root;
+    root.setEmpty();
+    for (const BVHPrimitive& primitive : primitives)
+        root.extendTo(primitive.cornerDown, primitive.cornerUp);
+
+    std::atomic<int64_t> budget((int64_t)(memoryBudget * primitives.size()));
+    std::vector<BVHPrimitive> references;
+    references.swap(primitives); // Consumed by the construction
+#ifdef BVH_PARALLEL_TASKS
+    #pragma omp parallel if(references.size() >= BVH_PARALLEL_TASK_SIZE)
+    #pragma omp single
+#endif
+    split(scenePtr, bvh, references, root.area(), budget, maxLeafSize, 0);
+}
+
+
+void SBVHBuilder::split(const std::shared_ptr<Scene>& scenePtr, BVH& node, std::vector<BVHPrimitive>& references, float rootArea, std::atomic<int64_t>& budget, size_t maxLeafSize, size_t depth) {
+    node.box.setEmpty();
+    for (const BVHPrimitive& reference : references)
+        node.box.extendTo(reference.cornerDown, reference.cornerUp);
+
+    if (references.size() == 1) {
+        node.box.add(references[0].mesh_index, references[0].triangle_index);
+        return;
+    }
+
+    // 1. Best object split, and a spatial one when the children of the object split overlap noticeably
+    std::vector<BVHPrimitive> left, right;
+    size_t remainingDepth = 0;
+    while (((size_t)1 << remainingDepth) < references.size()) remainingDepth++;
+    if (depth + remainingDepth + 1 < BVH_MAX_DEPTH) {
+        Split object = findObjectSplit(references);
+        Split spatial;
+        if (budget.load() > 0 && object.axis != -1 && overlapArea(object.left, object.right) > BVH_SPATIAL_SPLIT_ALPHA * rootArea)
+            spatial = findSpatialSplit(scenePtr, references, node.box);
+
+        if (spatial.axis != -1 && spatial.cost < object.cost) {
+            node.axis = spatial.axis;
+            node.median = spatial.position;
+            splitSpace(scenePtr, references, spatial, budget, left, right);
+        }
+        else if (object.axis != -1) {
+            node.axis = object.axis;
+            node.median = object.position;
+            splitObjects(references, object, left, right);
+        }
+    }
+
+    // 2. Same centroids, or too deep for the traversal stacks: cut in half
+    if (left.empty() || right.empty()) {
+        left.clear();
+        right.clear();
+        glm::vec3 extent = node.box.cornerUp - node.box.cornerDown;
+        node.axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+        size_t middle = references.size() / 2;
+        const int axis = node.axis;
+        std::nth_element(references.begin(), references.begin() + middle, references.end(), [axis](const BVHPrimitive& a, const BVHPrimitive& b) {
+            return a.centroid[axis] < b.centroid[axis];
+        });
+        node.median = references[middle].centroid[axis];
+        left.assign(references.begin(), references.begin() + middle);
+        right.assign(references.begin() + middle, references.end());
+    }
+
+    // 3. SAH termination of the small nodes
+    if (references.size() <= maxLeafSize) {
+        AABBox leftBox, rightBox;
+        leftBox.setEmpty();
+        rightBox.setEmpty();
+        for (const BVHPrimitive& reference : left) leftBox.extendTo(reference.cornerDown, reference.cornerUp);
+        for (const BVHPrimitive& reference : right) rightBox.extendTo(reference.cornerDown, reference.cornerUp);
+        if (BVH::isLeafCheaper(node.box.area(), references.size(), leftBox.area(), left.size(), rightBox.area(), right.size())) {
+            node.axis = -1;
+            for (const BVHPrimitive& reference : references)
+                node.box.add(reference.mesh_index, reference.triangle_index);
+            return;
+        }
+    }
+    std::vector<BVHPrimitive>().swap(references); // The children own their references now
+
+    // 4. Children
+    node.child_left = new BVH();
+    node.child_right = new BVH();
+#ifdef BVH_PARALLEL_TASKS
+    if (left.size() + right.size() >= BVH_PARALLEL_TASK_SIZE && omp_in_parallel()) {
+        // The task only gets the child, a reference to the node would make it copy the node
+        BVH* leftChild = node.child_left;
+        #pragma omp task shared(scenePtr, budget, left) firstprivate(leftChild)
+        split(scenePtr, *leftChild, left, rootArea, budget, maxLeafSize, depth + 1);
+        split(scenePtr, *node.child_right, right, rootArea, budget, maxLeafSize, depth + 1);
+        #pragma omp taskwait
+        return;
+    }
+#endif
+    split(scenePtr, *node.child_left, left, rootArea, budget, maxLeafSize, depth + 1);
+    split(scenePtr, *node.child_right, right, rootArea, budget, maxLeafSize, depth + 1);
+}
+
+
+SBVHBuilder::Split SBVHBuilder::findObjectSplit(const std::vector<BVHPrimitive>& references) {
+    glm::vec3 centroidMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 centroidMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for (const BVHPrimitive& reference : references) {
+        centroidMin = glm::min(centroidMin, reference.centroid);
+        centroidMax = glm::max(centroidMax, reference.centroid);
+    }
+
+    Split best;
+    for (int a = 0; a < 3; a++) {
+        float extent = centroidMax[a] - centroidMin[a];
+        if (extent <= 0.0f) continue;
+        float scale = BVH_SAH_BINS / extent;
+
+        AABBox boxes[BVH_SAH_BINS];
+        size_t counts[BVH_SAH_BINS] = {};
+        for (size_t b = 0; b < BVH_SAH_BINS; b++) boxes[b].setEmpty();
+        for (const BVHPrimitive& reference : references) {
+            size_t b = std::min(BVH_SAH_BINS - 1, (size_t)((reference.centroid[a] - centroidMin[a]) * scale));
+            boxes[b].extendTo(reference.cornerDown, reference.cornerUp);
+            counts[b]++;
+        }
+
+        // Sweep from the right, then evaluate from the left
+        AABBox rightBoxes[BVH_SAH_BINS - 1];
+        size_t rightCounts[BVH_SAH_BINS - 1];
+        AABBox accumulated;
+        accumulated.setEmpty();
+        size_t count = 0;
+        for (size_t b = BVH_SAH_BINS - 1; b > 0; b--) {
+            accumulated.extendTo(boxes[b]);
+            count += counts[b];
+            rightBoxes[b - 1] = AABBox(accumulated.cornerUp, accumulated.cornerDown);
+            rightCounts[b - 1] = count;
+        }
+        accumulated.setEmpty();
+        count = 0;
+        for (size_t b = 0; b < BVH_SAH_BINS - 1; b++) {
+            accumulated.extendTo(boxes[b]);
+            count += counts[b];
+            if (count == 0 || rightCounts[b] == 0) continue;
+            float cost = accumulated.area() * count + rightBoxes[b].area() * rightCounts[b];
+            if (cost < best.cost) {
+                best.axis = a;
+                best.position = centroidMin[a] + (b + 1) / scale;
+                best.cost = cost;
+                best.left = AABBox(accumulated.cornerUp, accumulated.cornerDown);
+                best.right = rightBoxes[b];
+                best.leftCount = count;
+                best.rightCount = rightCounts[b];
+            }
+        }
+    }
+    return best;
+}
+
+
+SBVHBuilder::Split SBVHBuilder::findSpatialSplit(const std::shared_ptr<Scene>& scenePtr, const std::vector<BVHPrimitive>& references, const AABBox& box) {
+    Split best;
+    for (int a = 0; a < 3; a++) {
+        float extent = box.cornerUp[a] - box.cornerDown[a];
+        if (extent <= 0.0f) continue;
+        float width = extent / BVH_SAH_BINS;
+
+        // Each reference is clipped to the bins it spans, it enters the first one and exits the last one
+        AABBox boxes[BVH_SAH_BINS];
+        size_t entries[BVH_SAH_BINS] = {};
+        size_t exits[BVH_SAH_BINS] = {};
+        for (size_t b = 0; b < BVH_SAH_BINS; b++) boxes[b].setEmpty();
+        for (const BVHPrimitive& reference : references) {
+            size_t first = std::min(BVH_SAH_BINS - 1, (size_t)std::max(0.0f, (reference.cornerDown[a] - box.cornerDown[a]) / width));
+            size_t last = std::min(BVH_SAH_BINS - 1, (size_t)std::max(0.0f, (reference.cornerUp[a] - box.cornerDown[a]) / width));
+            entries[first]++;
+            exits[last]++;
+            if (first == last) {
+                boxes[first].extendTo(reference.cornerDown, reference.cornerUp);
+                continue;
+            }
+            for (size_t b = first; b <= last; b++) {
+                glm::vec3 cornerDown, cornerUp;
+                float lower = box.cornerDown[a] + b * width;
+                float upper = (b == BVH_SAH_BINS - 1) ? box.cornerUp[a] : lower + width;
+                if (clip(scenePtr, reference, a, lower, upper, cornerDown, cornerUp))
+                    boxes[b].extendTo(cornerDown, cornerUp);
+            }
+        }
+
+        AABBox rightBoxes[BVH_SAH_BINS - 1];
+        size_t rightCounts[BVH_SAH_BINS - 1];
+        AABBox accumulated;
+        accumulated.setEmpty();
+        size_t count = 0;
+        for (size_t b = BVH_SAH_BINS - 1; b > 0; b--) {
+            accumulated.extendTo(boxes[b]);
+            count += exits[b];
+            rightBoxes[b - 1] = AABBox(accumulated.cornerUp, accumulated.cornerDown);
+            rightCounts[b - 1] = count;
+        }
+        accumulated.setEmpty();
+        count = 0;
+        for (size_t b = 0; b < BVH_SAH_BINS - 1; b++) {
+            accumulated.extendTo(boxes[b]);
+            count += entries[b];
+            if (count == 0 || rightCounts[b] == 0) continue;
+            float cost = accumulated.area() * count + rightBoxes[b].area() * rightCounts[b];
+            if (cost < best.cost) {
+                best.axis = a;
+                best.position = box.cornerDown[a] + (b + 1) * width;
+                best.cost = cost;
+                best.left = AABBox(accumulated.cornerUp, accumulated.cornerDown);
+                best.right = rightBoxes[b];
+                best.leftCount = count;
+                best.rightCount = rightCounts[b];
+            }
+        }
+    }
+    return best;
+}
+
+
+void SBVHBuilder::splitObjects(std::vector<BVHPrimitive>& references, const Split& split, std::vector<BVHPrimitive>& left, std::vector<BVHPrimitive>& right) {
+    left.reserve(split.leftCount);
+    right.reserve(split.rightCount);
+    for (const BVHPrimitive& reference : references) {
+        if (reference.centroid[split.axis] < split.position) left.push_back(reference);
+        else right.push_back(reference);
+    }
+}
+
+
+void SBVHBuilder::splitSpace(const std::shared_ptr<Scene>& scenePtr, std::vector<BVHPrimitive>& references, const Split& split, std::atomic<int64_t>& budget, std::vector<BVHPrimitive>& left, std::vector<BVHPrimitive>& right) {
+    const int axis = split.axis;
+    const float leftArea = split.left.area();
+    const float rightArea = split.right.area();
+    const float splitCost = leftArea * split.leftCount + rightArea * split.rightCount;
+    left.reserve(split.leftCount);
+    right.reserve(split.rightCount);
+
+    for (const BVHPrimitive& reference : references) {
+        if (reference.cornerUp[axis] <= split.position) {
+            left.push_back(reference);
+            continue;
+        }
+        if (reference.cornerDown[axis] >= split.position) {
+            right.push_back(reference);
+            continue;
+        }
+
+        // A reference crossing the plane may cost less whole on one side than duplicated
+        AABBox leftWith = split.left;
+        leftWith.extendTo(reference.cornerDown, reference.cornerUp);
+        AABBox rightWith = split.right;
+        rightWith.extendTo(reference.cornerDown, reference.cornerUp);
+        float leftCost = leftWith.area() * split.leftCount + rightArea * (split.rightCount - 1);
+        float rightCost = leftArea * (split.leftCount - 1) + rightWith.area() * split.rightCount;
+
+        BVHPrimitive leftPart = reference;
+        BVHPrimitive rightPart = reference;
+        bool duplicate = splitCost <= std::min(leftCost, rightCost)
+            && clip(scenePtr, reference, axis, reference.cornerDown[axis], split.position, leftPart.cornerDown, leftPart.cornerUp)
+            && clip(scenePtr, reference, axis, split.position, reference.cornerUp[axis], rightPart.cornerDown, rightPart.cornerUp);
+        if (duplicate && budget.fetch_sub(1) <= 0) {
+            budget.fetch_add(1); // Out of memory budget, keep it whole
+            duplicate = false;
+        }
+
+        if (duplicate) {
+            leftPart.centroid = 0.5f * (leftPart.cornerDown + leftPart.cornerUp);
+            rightPart.centroid = 0.5f * (rightPart.cornerDown + rightPart.cornerUp);
+            left.push_back(leftPart);
+            right.push_back(rightPart);
+        }
+        else if (leftCost <= rightCost) left.push_back(reference);
+        else right.push_back(reference);
+    }
+}
+
+
+bool SBVHBuilder::clip(const std::shared_ptr<Scene>& scenePtr, const BVHPrimitive& reference, int axis, float lower, float upper, glm::vec3& cornerDown, glm::vec3& cornerUp) {
+    const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(reference.mesh_index);
+    const glm::uvec3& triangleIndex = mesh->triangleIndices()[reference.triangle_index];
+    const std::vector<glm::vec3>& positions = mesh->vertexPositions();
+
+    // The vertices within the slab, and the crossings of the edges with its two planes
+    cornerDown = glm::vec3(std::numeric_limits<float>::max());
+    cornerUp = glm::vec3(std::numeric_limits<float>::lowest());
+    for (int k = 0; k < 3; k++) {
+        const glm::vec3& p0 = positions[triangleIndex[k]];
+        const glm::vec3& p1 = positions[triangleIndex[(k + 1) % 3]];
+        if (p0[axis] >= lower && p0[axis] <= upper) extend(cornerDown, cornerUp, p0);
+        for (float plane : { lower, upper }) {
+            if ((p0[axis] < plane) == (p1[axis] < plane)) continue;
+            glm::vec3 crossing = glm::mix(p0, p1, (plane - p0[axis]) / (p1[axis] - p0[axis]));
+            crossing[axis] = plane;
+            extend(cornerDown, cornerUp, crossing);
+        }
+    }
+
+    // Within the reference, which may already be a clipped part of the triangle
+    cornerDown = glm::max(cornerDown, reference.cornerDown);
+    cornerUp = glm::min(cornerUp, reference.cornerUp);
+    cornerDown[axis] = std::max(cornerDown[axis], lower);
+    cornerUp[axis] = std::min(cornerUp[axis], upper);
+    return cornerDown.x <= cornerUp.x && cornerDown.y <= cornerUp.y && cornerDown.z <= cornerUp.z;
+}
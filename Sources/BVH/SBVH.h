@@ -0,0 +1,46 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+#include "BVH.h"
+
+
+/// Spatial split BVH builder: on top of the binned SAH object splits, a node can be cut by a plane,
+/// the triangles crossing it being clipped and referenced on both sides. Large triangles then stop
+/// inflating the boxes of the nodes around them, at the cost of more references.
+/// A triangle may appear in several leaves.
+class SBVHBuilder {
+
+public:
+    /// Builds the tree in 'bvh', which must be empty. 'memoryBudget' is the number of extra references allowed,
+    /// relative to the number of triangles.
+    static void build(const std::shared_ptr<Scene>& scenePtr, std::vector<BVHPrimitive>& primitives, BVH& bvh, float memoryBudget = BVH_SPATIAL_SPLIT_BUDGET, size_t maxLeafSize = BVH_MAX_LEAF_SIZE);
+
+private:
+    struct Split {
+        int axis = -1;
+        float position = 0.0f; // Plane of a spatial split, boundary of the bins of an object split
+        float cost = std::numeric_limits<float>::max();
+        AABBox left;
+        AABBox right;
+        size_t leftCount = 0;
+        size_t rightCount = 0;
+    };
+
+    static void split(const std::shared_ptr<Scene>& scenePtr, BVH& node, std::vector<BVHPrimitive>& references, float rootArea, std::atomic<int64_t>& budget, size_t maxLeafSize, size_t depth);
+    static Split findObjectSplit(const std::vector<BVHPrimitive>& references);
+    static Split findSpatialSplit(const std::shared_ptr<Scene>& scenePtr, const std::vector<BVHPrimitive>& references, const AABBox& box);
+    static void splitObjects(std::vector<BVHPrimitive>& references, const Split& split, std::vector<BVHPrimitive>& left, std::vector<BVHPrimitive>& right);
+    static void splitSpace(const std::shared_ptr<Scene>& scenePtr, std::vector<BVHPrimitive>& references, const Split& split, std::atomic<int64_t>& budget, std::vector<BVHPrimitive>& left, std::vector<BVHPrimitive>& right);
+    /// Bounds of the part of the triangle of 'reference' between 'lower' and 'upper' along the axis, within the box of the reference.
+    static bool clip(const std::shared_ptr<Scene>& scenePtr, const BVHPrimitive& reference, int axis, float lower, float upper, glm::vec3& cornerDown, glm::vec3& cornerUp);
+};
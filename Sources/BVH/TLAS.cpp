@@ -0,0 +1,481 @@
+#include "TLAS.h"
+
+
+void TLAS::init(const std::shared_ptr<Scene>& scenePtr, BVHLayout layout_, BVHSplitMethod splitMethod_, BVHMortonPrecision mortonPrecision_, size_t maxLeafSize_, bool useCache) {
+    clear();
+    layout = layout_;
+    splitMethod = splitMethod_;
+    mortonPrecision = mortonPrecision_;
+    maxLeafSize = maxLeafSize_;
+
+    // 1. One bottom level per mesh, in object space
+    size_t numOfMeshes = scenePtr->numOfMeshes();
+    objectBounds.resize(numOfMeshes);
+    blasTriangles.resize(numOfMeshes);
+    blasCosts.resize(numOfMeshes);
+    blasBuildCosts.resize(numOfMeshes);
+    if (layout == BVHLayout::Tree) trees.resize(numOfMeshes);
+    else if (layout == BVHLayout::Linear) linearBVHs.resize(numOfMeshes);
+    else if (layout == BVHLayout::Wide4) bvh4s.resize(numOfMeshes);
+    else bvh8s.resize(numOfMeshes);
+    for (size_t i = 0; i < numOfMeshes; i++) {
+        if (useCache && loadBLAS(scenePtr, i)) numOfCacheHits++;
+        else buildBLAS(scenePtr, i, useCache);
+    }
+
+    // 2. Top level over the instances
+    update(scenePtr);
+}
+
+void TLAS::buildBLAS(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, bool saveToCache) {
+    std::unique_ptr<BVH> bvh = std::make_unique<BVH>();
+    bvh->initMesh(scenePtr, meshIndex, splitMethod, mortonPrecision, maxLeafSize);
+    blasTriangles[meshIndex] = scenePtr->mesh(meshIndex)->triangleIndices().size();
+
+    // The tree is not needed anymore once converted
+    if (layout == BVHLayout::Tree) trees[meshIndex] = std::move(bvh);
+    else if (layout == BVHLayout::Linear) linearBVHs[meshIndex].init(scenePtr, *bvh);
+    else if (layout == BVHLayout::Wide4) bvh4s[meshIndex].init(scenePtr, *bvh);
+    else bvh8s[meshIndex].init(scenePtr, *bvh);
+
+    computeObjectBounds(meshIndex);
+    blasCosts[meshIndex] = computeBLASCost(meshIndex);
+    blasBuildCosts[meshIndex] = blasCosts[meshIndex];
+
+    const Mesh& mesh = *scenePtr->mesh(meshIndex);
+    if (!saveToCache || layout == BVHLayout::Tree || mesh.filename().empty()) return;
+    BVHCacheKey key = BVHCache::computeKey(mesh, layout, splitMethod, mortonPrecision, maxLeafSize);
+    std::string filename = BVHCache::filename(mesh.filename(), layout);
+    if (layout == BVHLayout::Linear) BVHCache::save(filename, key, linearBVHs[meshIndex]);
+    else if (layout == BVHLayout::Wide4) BVHCache::save(filename, key, bvh4s[meshIndex]);
+    else BVHCache::save(filename, key, bvh8s[meshIndex]);
+}
+
+bool TLAS::loadBLAS(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex) {
+    const Mesh& mesh = *scenePtr->mesh(meshIndex);
+    if (layout == BVHLayout::Tree || mesh.filename().empty()) return false;
+    BVHCacheKey key = BVHCache::computeKey(mesh, layout, splitMethod, mortonPrecision, maxLeafSize);
+    std::string filename = BVHCache::filename(mesh.filename(), layout);
+    bool loaded = false;
+    if (layout == BVHLayout::Linear) loaded = BVHCache::load(filename, key, scenePtr, meshIndex, linearBVHs[meshIndex]);
+    else if (layout == BVHLayout::Wide4) loaded = BVHCache::load(filename, key, scenePtr, meshIndex, bvh4s[meshIndex]);
+    else loaded = BVHCache::load(filename, key, scenePtr, meshIndex, bvh8s[meshIndex]);
+    if (!loaded) return false;
+
+    blasTriangles[meshIndex] = mesh.triangleIndices().size();
+    computeObjectBounds(meshIndex);
+    blasCosts[meshIndex] = computeBLASCost(meshIndex);
+    blasBuildCosts[meshIndex] = blasCosts[meshIndex];
+    return true;
+}
+
+void TLAS::refitBLAS(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex) {
+    if (layout == BVHLayout::Tree) trees[meshIndex]->refit(scenePtr);
+    else if (layout == BVHLayout::Linear) linearBVHs[meshIndex].refit(scenePtr);
+    else if (layout == BVHLayout::Wide4) bvh4s[meshIndex].refit(scenePtr);
+    else bvh8s[meshIndex].refit(scenePtr);
+    computeObjectBounds(meshIndex);
+    blasCosts[meshIndex] = computeBLASCost(meshIndex);
+}
+
+void TLAS::computeObjectBounds(size_t meshIndex) {
+    AABBox& box = objectBounds[meshIndex];
+    box.setEmpty();
+    if (blasTriangles[meshIndex] == 0) return;
+    if (layout == BVHLayout::Tree) box = AABBox(trees[meshIndex]->box.cornerUp, trees[meshIndex]->box.cornerDown);
+    else if (layout == BVHLayout::Linear) box = AABBox(linearBVHs[meshIndex].nodes[0].cornerUp, linearBVHs[meshIndex].nodes[0].cornerDown);
+    else if (layout == BVHLayout::Wide4) bvh4s[meshIndex].computeBounds(0, box.cornerDown, box.cornerUp);
+    else bvh8s[meshIndex].computeBounds(0, box.cornerDown, box.cornerUp);
+}
+
+float TLAS::computeBLASCost(size_t meshIndex) const {
+    if (layout == BVHLayout::Tree) return trees[meshIndex]->computeSAHCost();
+    if (layout == BVHLayout::Linear) return linearBVHs[meshIndex].computeSAHCost();
+    if (layout == BVHLayout::Wide4) return bvh4s[meshIndex].computeSAHCost();
+    return bvh8s[meshIndex].computeSAHCost();
+}
+
+bool TLAS::refit(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, float maxDegradation) {
+    if (meshIndex >= numOfBLAS()) return false;
+
+    // Triangles added or removed do not fit in the leaves anymore
+    bool rebuild = scenePtr->mesh(meshIndex)->triangleIndices().size() != blasTriangles[meshIndex];
+    if (!rebuild) {
+        refitBLAS(scenePtr, meshIndex);
+        rebuild = blasCosts[meshIndex] > maxDegradation * blasBuildCosts[meshIndex];
+    }
+    if (rebuild) buildBLAS(scenePtr, meshIndex, false);
+
+    // The world boxes of the instances of the mesh changed
+    update(scenePtr);
+    return rebuild;
+}
+
+float TLAS::computeSAHCost() const {
+    double weightedCost = 0.0;
+    size_t numOfTriangles = 0;
+    for (size_t i = 0; i < blasCosts.size(); i++) {
+        weightedCost += (double)blasCosts[i] * blasTriangles[i];
+        numOfTriangles += blasTriangles[i];
+    }
+    return (numOfTriangles > 0) ? (float)(weightedCost / numOfTriangles) : 0.0f;
+}
+
+void TLAS::clear() {
+    trees.clear();
+    linearBVHs.clear();
+    bvh4s.clear();
+    bvh8s.clear();
+    objectBounds.clear();
+    blasTriangles.clear();
+    blasCosts.clear();
+    blasBuildCosts.clear();
+    numOfCacheHits = 0;
+    instances.clear();
+    nodes.clear();
+}
+
+void TLAS::update(const std::shared_ptr<Scene>& scenePtr) {
+    size_t numOfInstances = scenePtr->numOfInstances();
+    bool rebuild = (numOfInstances != instances.size()) || nodes.empty();
+    instances.resize(numOfInstances);
+    for (size_t i = 0; i < numOfInstances; i++)
+        updateInstance(scenePtr, i);
+
+    if (!rebuild) {
+        refitTopLevel(0);
+        return;
+    }
+    nodes.clear();
+    if (numOfInstances == 0) return;
+    std::vector<uint32_t> order(numOfInstances);
+    for (size_t i = 0; i < numOfInstances; i++) order[i] = (uint32_t)i;
+    nodes.reserve(2 * numOfInstances - 1);
+    buildTopLevel(order, 0, numOfInstances);
+}
+
+void TLAS::updateInstance(const std::shared_ptr<Scene>& scenePtr, size_t index) {
+    const MeshInstance& meshInstance = scenePtr->instance(index);
+    TLASInstance& instance = instances[index];
+    instance.mesh_index = meshInstance.mesh_index;
+    instance.objectToWorld = meshInstance.transform->computeTransformMatrix();
+    instance.worldToObject = glm::inverse(instance.objectToWorld);
+
+    // World bounds of the 8 corners of the object box, empty for a mesh added after the construction
+    instance.cornerDown = glm::vec3(std::numeric_limits<float>::max());
+    instance.cornerUp = glm::vec3(std::numeric_limits<float>::lowest());
+    if (instance.mesh_index >= objectBounds.size()) return;
+    const AABBox& box = objectBounds[instance.mesh_index];
+    if (box.cornerDown.x > box.cornerUp.x) return;
+    for (int c = 0; c < 8; c++) {
+        glm::vec3 corner((c & 1) ? box.cornerUp.x : box.cornerDown.x,
+                         (c & 2) ? box.cornerUp.y : box.cornerDown.y,
+                         (c & 4) ? box.cornerUp.z : box.cornerDown.z);
+        glm::vec3 p = glm::vec3(instance.objectToWorld * glm::vec4(corner, 1.0f));
+        instance.cornerDown = glm::min(instance.cornerDown, p);
+        instance.cornerUp = glm::max(instance.cornerUp, p);
+    }
+}
+
+uint32_t TLAS::buildTopLevel(std::vector<uint32_t>& order, size_t begin, size_t end) {
+    uint32_t nodeIndex = (uint32_t)nodes.size();
+    nodes.emplace_back();
+    if (end - begin == 1) {
+        const TLASInstance& instance = instances[order[begin]];
+        nodes[nodeIndex] = { instance.cornerDown, order[begin], instance.cornerUp, 1 };
+        return nodeIndex;
+    }
+
+    // Median of the centers along the largest axis, there are few instances
+    glm::vec3 centerMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 centerMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for (size_t i = begin; i < end; i++) {
+        glm::vec3 center = 0.5f * (instances[order[i]].cornerDown + instances[order[i]].cornerUp);
+        centerMin = glm::min(centerMin, center);
+        centerMax = glm::max(centerMax, center);
+    }
+    glm::vec3 extent = centerMax - centerMin;
+    int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+    size_t middle = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](uint32_t a, uint32_t b) {
+        return instances[a].cornerDown[axis] + instances[a].cornerUp[axis] < instances[b].cornerDown[axis] + instances[b].cornerUp[axis];
+    });
+
+    buildTopLevel(order, begin, middle);
+    uint32_t right = buildTopLevel(order, middle, end);
+    TLASNode& node = nodes[nodeIndex]; // The vector does not grow beyond its reserved size
+    node.index = right;
+    node.isLeaf = 0;
+    node.cornerDown = glm::min(nodes[nodeIndex + 1].cornerDown, nodes[right].cornerDown);
+    node.cornerUp = glm::max(nodes[nodeIndex + 1].cornerUp, nodes[right].cornerUp);
+    return nodeIndex;
+}
+
+void TLAS::refitTopLevel(uint32_t nodeIndex) {
+    TLASNode& node = nodes[nodeIndex];
+    if (node.isLeaf) {
+        node.cornerDown = instances[node.index].cornerDown;
+        node.cornerUp = instances[node.index].cornerUp;
+        return;
+    }
+    refitTopLevel(nodeIndex + 1);
+    refitTopLevel(node.index);
+    node.cornerDown = glm::min(nodes[nodeIndex + 1].cornerDown, nodes[node.index].cornerDown);
+    node.cornerUp = glm::max(nodes[nodeIndex + 1].cornerUp, nodes[node.index].cornerUp);
+}
+
+
+size_t TLAS::numOfNodes() const {
+    size_t count = nodes.size();
+    for (const std::unique_ptr<BVH>& tree : trees) count += tree->numOfNodes();
+    for (const LinearBVH& linearBVH : linearBVHs) count += linearBVH.numOfNodes();
+    for (const BVH4& bvh4 : bvh4s) count += bvh4.numOfNodes();
+    for (const BVH8& bvh8 : bvh8s) count += bvh8.numOfNodes();
+    return count;
+}
+
+size_t TLAS::memoryUsage() const {
+    size_t memory = nodes.size() * sizeof(TLASNode) + instances.size() * sizeof(TLASInstance);
+    for (const std::unique_ptr<BVH>& tree : trees) memory += tree->numOfNodes() * sizeof(BVH);
+    for (const LinearBVH& linearBVH : linearBVHs) memory += linearBVH.memoryUsage();
+    for (const BVH4& bvh4 : bvh4s) memory += bvh4.memoryUsage();
+    for (const BVH8& bvh8 : bvh8s) memory += bvh8.memoryUsage();
+    return memory;
+}
+
+
+bool TLAS::intersectBLAS(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, RayHit& rayHit, const Ray& ray, size_t& triangle_index) const {
+    size_t mesh_index = 0;
+    if (layout == BVHLayout::Linear) return linearBVHs[meshIndex].intersect(rayHit, ray, mesh_index, triangle_index);
+    if (layout == BVHLayout::Wide4) return bvh4s[meshIndex].intersect(rayHit, ray, mesh_index, triangle_index);
+    if (layout == BVHLayout::Wide8) return bvh8s[meshIndex].intersect(rayHit, ray, mesh_index, triangle_index);
+    return trees[meshIndex]->intersect(scenePtr, rayHit, ray, mesh_index, triangle_index);
+}
+
+bool TLAS::fastIntersectBLAS(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, const Ray& ray, float tmin, float tmax) const {
+    if (layout == BVHLayout::Linear) return linearBVHs[meshIndex].fastIntersect(ray, tmin, tmax);
+    if (layout == BVHLayout::Wide4) return bvh4s[meshIndex].fastIntersect(ray, tmin, tmax);
+    if (layout == BVHLayout::Wide8) return bvh8s[meshIndex].fastIntersect(ray, tmin, tmax);
+    return trees[meshIndex]->fastIntersect(scenePtr, ray, tmin, tmax);
+}
+
+/// The ray in the space of the mesh. The direction is not normalized, so the distances stay the ones of the world.
+inline Ray toObject(const TLASInstance& instance, const Ray& ray) {
+    return Ray(glm::vec3(instance.worldToObject * glm::vec4(ray.origin, 1.0f)),
+               glm::vec3(instance.worldToObject * glm::vec4(ray.direction, 0.0f)));
+}
+
+
+bool TLAS::intersect(const std::shared_ptr<Scene>& scenePtr, RayHit& rayHit, const Ray& ray, size_t& instance_index, size_t& triangle_index) const {
+    if (nodes.empty()) return false;
+    const TLASNode* nodesPtr = nodes.data();
+
+    float tmin = 0;
+    if (!AABBox::intersect(nodesPtr[0].cornerDown, nodesPtr[0].cornerUp, ray, tmin)) return false;
+
+    struct StackEntry {
+        uint32_t node;
+        float tmin;
+    };
+    StackEntry stack[BVH_MAX_DEPTH];
+    size_t stackSize = 0;
+    stack[stackSize++] = { 0, tmin };
+
+    bool hit = false;
+    while (stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+        if (entry.tmin >= rayHit.t) continue; // We won't find a closer intersection there
+
+        const TLASNode& node = nodesPtr[entry.node];
+        if (node.isLeaf) {
+            const TLASInstance& instance = instances[node.index];
+            size_t triangle = 0;
+            if (intersectBLAS(scenePtr, instance.mesh_index, rayHit, toObject(instance, ray), triangle)) {
+                instance_index = node.index;
+                triangle_index = triangle;
+                hit = true;
+            }
+            continue;
+        }
+
+        // The closest child is pushed last to be visited first
+        uint32_t left = entry.node + 1;
+        uint32_t right = node.index;
+        float tminLeft = 0;
+        bool intersectLeft = AABBox::intersect(nodesPtr[left].cornerDown, nodesPtr[left].cornerUp, ray, tminLeft);
+        float tminRight = 0;
+        bool intersectRight = AABBox::intersect(nodesPtr[right].cornerDown, nodesPtr[right].cornerUp, ray, tminRight);
+
+        if (intersectLeft && intersectRight) {
+            if (tminRight < tminLeft) {
+                stack[stackSize++] = { left, tminLeft };
+                stack[stackSize++] = { right, tminRight };
+            }
+            else {
+                stack[stackSize++] = { right, tminRight };
+                stack[stackSize++] = { left, tminLeft };
+            }
+        }
+        else if (intersectLeft)  stack[stackSize++] = { left, tminLeft };
+        else if (intersectRight) stack[stackSize++] = { right, tminRight };
+    }
+    return hit;
+}
+
+bool TLAS::fastIntersect(const std::shared_ptr<Scene>& scenePtr, const Ray& ray, float tmin, float tmax) const {
+    if (nodes.empty()) return false;
+    const TLASNode* nodesPtr = nodes.data();
+
+    if (!AABBox::overlaps(nodesPtr[0].cornerDown, nodesPtr[0].cornerUp, ray, tmin, tmax)) return false;
+
+    uint32_t stack[BVH_MAX_DEPTH];
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        const TLASNode& node = nodesPtr[stack[--stackSize]];
+        if (node.isLeaf) {
+            const TLASInstance& instance = instances[node.index];
+            // The distances are the same in object space
+            if (fastIntersectBLAS(scenePtr, instance.mesh_index, toObject(instance, ray), tmin, tmax)) return true; // Any hit will do
+            continue;
+        }
+
+        uint32_t left = (uint32_t)(&node - nodesPtr) + 1;
+        uint32_t right = node.index;
+        if (AABBox::overlaps(nodesPtr[right].cornerDown, nodesPtr[right].cornerUp, ray, tmin, tmax))
+            stack[stackSize++] = right;
+        if (AABBox::overlaps(nodesPtr[left].cornerDown, nodesPtr[left].cornerUp, ray, tmin, tmax))
+            stack[stackSize++] = left;
+    }
+    return false;
+}
+
+void TLAS::fastIntersect(const std::shared_ptr<Scene>& scenePtr, ShadowRay* shadowRays, size_t count) const {
+    for (size_t begin = 0; begin < count; begin += SHADOW_RAY_BATCH_SIZE)
+        fastIntersectBatch(scenePtr, shadowRays + begin, std::min(SHADOW_RAY_BATCH_SIZE, count - begin));
+}
+
+void TLAS::fastIntersectBatch(const std::shared_ptr<Scene>& scenePtr, ShadowRay* shadowRays, size_t count) const {
+    for (size_t i = 0; i < count; i++) shadowRays[i].occluded = false;
+    if (nodes.empty() || count == 0) return;
+    const TLASNode* nodesPtr = nodes.data();
+
+    // The top level is walked once for the whole batch, each node with the mask of the rays which may cross it.
+    // An occluded ray leaves the batch, which stops as soon as all of them are.
+    struct StackEntry {
+        uint32_t node;
+        uint32_t rays;
+    };
+    StackEntry stack[BVH_MAX_DEPTH];
+    size_t stackSize = 0;
+    uint32_t active = (count == 32) ? ~0u : ((1u << count) - 1);
+    stack[stackSize++] = { 0, active };
+
+    while (stackSize > 0 && active != 0) {
+        StackEntry entry = stack[--stackSize];
+        const TLASNode& node = nodesPtr[entry.node];
+        uint32_t rays = 0;
+        const uint32_t candidates = entry.rays & active;
+        for (size_t i = 0; i < count; i++) {
+            if (!(candidates & (1u << i))) continue;
+            if (AABBox::overlaps(node.cornerDown, node.cornerUp, shadowRays[i].ray, shadowRays[i].tmin, shadowRays[i].tmax))
+                rays |= 1u << i;
+        }
+        if (rays == 0) continue;
+
+        if (node.isLeaf) {
+            const TLASInstance& instance = instances[node.index];
+            for (size_t i = 0; i < count; i++) {
+                if (!(rays & (1u << i))) continue;
+                ShadowRay& shadowRay = shadowRays[i];
+                if (fastIntersectBLAS(scenePtr, instance.mesh_index, toObject(instance, shadowRay.ray), shadowRay.tmin, shadowRay.tmax)) {
+                    shadowRay.occluded = true;
+                    active &= ~(1u << i);
+                }
+            }
+            continue;
+        }
+
+        stack[stackSize++] = { node.index, rays };
+        stack[stackSize++] = { entry.node + 1, rays };
+    }
+}
+
+void TLAS::intersect(const std::shared_ptr<Scene>& scenePtr, RayPacket& packet) const {
+    // Only the linear layout has a packet traversal, the other ones and the diverging packets go ray by ray
+    if (layout != BVHLayout::Linear || !packet.coherent) {
+        for (size_t i = 0; i < packet.size; i++) {
+            if (intersect(scenePtr, packet.rayHits[i], packet.rays[i], packet.instance_index[i], packet.triangle_index[i]))
+                packet.hit[i] = true;
+        }
+        return;
+    }
+    if (nodes.empty() || packet.size == 0) return;
+    const TLASNode* nodesPtr = nodes.data();
+
+    struct StackEntry {
+        uint32_t node;
+        uint32_t firstRay;
+    };
+    StackEntry stack[BVH_MAX_DEPTH];
+    size_t stackSize = 0;
+    stack[stackSize++] = { 0, 0 };
+
+    float maxDistance = packet.maxDistance();
+    RayPacket objectPacket;
+    while (stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+        const TLASNode& node = nodesPtr[entry.node];
+        if (!packet.mayIntersect(node.cornerDown, node.cornerUp, maxDistance)) continue;
+
+        uint32_t first = entry.firstRay;
+        float tmin = 0;
+        while (first < packet.size && !(AABBox::intersect(node.cornerDown, node.cornerUp, packet.rays[first], tmin) && tmin < packet.rayHits[first].t))
+            first++;
+        if (first == packet.size) continue;
+
+        if (node.isLeaf) {
+            const TLASInstance& instance = instances[node.index];
+            objectPacket.size = packet.size;
+            for (size_t i = 0; i < packet.size; i++) {
+                objectPacket.rays[i] = toObject(instance, packet.rays[i]);
+                objectPacket.rayHits[i] = packet.rayHits[i];
+                objectPacket.hit[i] = false;
+            }
+            // A rotation can spread the directions of the packet over both sides of an axis
+            objectPacket.computeBounds();
+            if (objectPacket.coherent) linearBVHs[instance.mesh_index].intersect(objectPacket);
+            else {
+                for (size_t i = first; i < packet.size; i++)
+                    objectPacket.hit[i] = intersectBLAS(scenePtr, instance.mesh_index, objectPacket.rayHits[i], objectPacket.rays[i], objectPacket.triangle_index[i]);
+            }
+
+            for (size_t i = 0; i < packet.size; i++) {
+                if (!objectPacket.hit[i]) continue;
+                packet.rayHits[i] = objectPacket.rayHits[i];
+                packet.hit[i] = true;
+                packet.instance_index[i] = node.index;
+                packet.triangle_index[i] = objectPacket.triangle_index[i];
+            }
+            maxDistance = packet.maxDistance();
+            continue;
+        }
+
+        // The closest child for the first ray is visited first
+        uint32_t left = entry.node + 1;
+        uint32_t right = node.index;
+        float tminLeft = std::numeric_limits<float>::max();
+        float tminRight = std::numeric_limits<float>::max();
+        AABBox::intersect(nodesPtr[left].cornerDown, nodesPtr[left].cornerUp, packet.rays[first], tminLeft);
+        AABBox::intersect(nodesPtr[right].cornerDown, nodesPtr[right].cornerUp, packet.rays[first], tminRight);
+        if (tminRight < tminLeft) {
+            stack[stackSize++] = { left, first };
+            stack[stackSize++] = { right, first };
+        }
+        else {
+            stack[stackSize++] = { right, first };
+            stack[stackSize++] = { left, first };
+        }
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "AABBox.h"
+#include "BVH.h"
+#include "LinearBVH.h"
+#include "WideBVH.h"
+#include "BVHCache.h"
+#include "RayPacket.h"
+#include "../Ray.h"
+#include "../Scene.h"
+
+
+static const size_t SHADOW_RAY_BATCH_SIZE (32); // Rays of a batch of occlusion queries, one bit each in a mask
+
+/// Node of the top level, in depth first order as the LinearBVHNode.
+struct TLASNode {
+    glm::vec3 cornerDown;
+    uint32_t index;  // Leaf: instance, internal node: right child (the left one follows)
+    glm::vec3 cornerUp;
+    uint32_t isLeaf;
+};
+
+/// World space placement of the bottom level BVH of a mesh.
+struct TLASInstance {
+    glm::mat4 objectToWorld;
+    glm::mat4 worldToObject;
+    glm::vec3 cornerDown; // World space bounds
+    glm::vec3 cornerUp;
+    size_t mesh_index;
+};
+
+
+/// Two level acceleration structure: a bottom level BVH per mesh in object space,
+/// and a top level BVH over the instances of the scene in world space.
+/// Moving instances only updates the top level.
+class TLAS {
+
+public:
+    TLAS() {};
+    /// With 'useCache', the bottom levels of the meshes loaded from a file are read from BVHCache files next to them,
+    /// and written there when they had to be built.
+    void init(const std::shared_ptr<Scene>& scenePtr, BVHLayout layout = BVHLayout::Linear, BVHSplitMethod splitMethod = BVHSplitMethod::SAH, BVHMortonPrecision mortonPrecision = BVHMortonPrecision::Bits30, size_t maxLeafSize = BVH_MAX_LEAF_SIZE, bool useCache = false);
+    /// Reads the transforms of the instances again. The top level is refitted, or rebuilt if instances were added.
+    void update(const std::shared_ptr<Scene>& scenePtr);
+    /// To call once the vertices of a mesh moved: its bottom level is refitted, or rebuilt when the SAH cost
+    /// grew past 'maxDegradation' times the cost it was built with, or when its triangles changed. Returns true on a rebuild.
+    bool refit(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, float maxDegradation = BVH_REFIT_MAX_DEGRADATION);
+    void clear();
+
+    /// 'instance_index' refers to Scene::instance, the mesh is the one of the instance.
+    bool intersect(const std::shared_ptr<Scene>& scenePtr, RayHit& rayHit, const Ray& ray, size_t& instance_index, size_t& triangle_index) const;
+    /// Any hit at a distance in [tmin, tmax), for the occlusion queries.
+    bool fastIntersect(const std::shared_ptr<Scene>& scenePtr, const Ray& ray, float tmin = 0.0f, float tmax = std::numeric_limits<float>::max()) const;
+    /// Occlusion of several rays, typically the shadow rays of a shading point. The top level is walked once
+    /// per SHADOW_RAY_BATCH_SIZE rays rather than once per ray.
+    void fastIntersect(const std::shared_ptr<Scene>& scenePtr, ShadowRay* shadowRays, size_t count) const;
+    /// Closest hits of the rays of the packet, see LinearBVH::intersect. Only the linear layout traces packets,
+    /// with the other layouts or when the directions of the packet diverge the rays are traced one by one.
+    void intersect(const std::shared_ptr<Scene>& scenePtr, RayPacket& packet) const;
+
+    inline size_t numOfBLAS() const { return objectBounds.size(); }
+    /// Bottom levels loaded from the cache by the last init rather than built.
+    inline size_t numOfCachedBLAS() const { return numOfCacheHits; }
+    inline size_t numOfInstances() const { return instances.size(); }
+    inline const TLASInstance& instance(size_t index) const { return instances[index]; }
+    size_t numOfNodes() const;
+    size_t memoryUsage() const;
+    /// SAH cost of the bottom levels, averaged with their number of triangles as weights.
+    float computeSAHCost() const;
+    inline float computeSAHCost(size_t meshIndex) const { return blasCosts[meshIndex]; }
+
+private:
+    void buildBLAS(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, bool saveToCache);
+    bool loadBLAS(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex);
+    void refitBLAS(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex);
+    void computeObjectBounds(size_t meshIndex);
+    float computeBLASCost(size_t meshIndex) const;
+    uint32_t buildTopLevel(std::vector<uint32_t>& order, size_t begin, size_t end);
+    void refitTopLevel(uint32_t nodeIndex);
+    void updateInstance(const std::shared_ptr<Scene>& scenePtr, size_t index);
+
+    bool intersectBLAS(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, RayHit& rayHit, const Ray& ray, size_t& triangle_index) const;
+    bool fastIntersectBLAS(const std::shared_ptr<Scene>& scenePtr, size_t meshIndex, const Ray& ray, float tmin, float tmax) const;
+    void fastIntersectBatch(const std::shared_ptr<Scene>& scenePtr, ShadowRay* shadowRays, size_t count) const;
+
+    BVHLayout layout = BVHLayout::Linear;
+    BVHSplitMethod splitMethod = BVHSplitMethod::SAH;
+    BVHMortonPrecision mortonPrecision = BVHMortonPrecision::Bits30;
+    size_t maxLeafSize = BVH_MAX_LEAF_SIZE;
+    // Bottom levels, one per mesh, only the vector of the layout is filled
+    std::vector<std::unique_ptr<BVH>> trees;
+    std::vector<LinearBVH> linearBVHs;
+    std::vector<BVH4> bvh4s;
+    std::vector<BVH8> bvh8s;
+    std::vector<AABBox> objectBounds;
+    std::vector<size_t> blasTriangles;
+    std::vector<float> blasCosts;      // Current SAH cost
+    std::vector<float> blasBuildCosts; // SAH cost right after the last build, the reference of the refits
+    size_t numOfCacheHits = 0;
+
+    std::vector<TLASInstance> instances;
+    std::vector<TLASNode> nodes;
+};
@@ -0,0 +1,321 @@
+#include "WideBVH.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WIDE_BVH_SSE
+#include <immintrin.h>
+#endif
+
+
+namespace {
+
+/// Slab test of the children of a node. Returns the mask of the children hit between tmin and tmax and their entry distances.
+template <size_t N>
+inline unsigned int intersectChildren(const WideBVHNode<N>& node, const Ray& ray, float tmin, float tmax, float* tmins) {
+    unsigned int mask = 0;
+    for (size_t i = 0; i < node.numOfChildren; i++) {
+        float tnear = tmin;
+        float tfar = tmax;
+        for (int a = 0; a < 3; a++) {
+            float t1 = (node.bounds[a][i]     - ray.origin[a]) * ray.inv_dir[a];
+            float t2 = (node.bounds[a + 3][i] - ray.origin[a]) * ray.inv_dir[a];
+            tnear = std::max(tnear, std::min(t1, t2));
+            tfar  = std::min(tfar,  std::max(t1, t2));
+        }
+        tmins[i] = tnear;
+        if (tnear <= tfar) mask |= 1u << i;
+    }
+    return mask;
+}
+
+#ifdef WIDE_BVH_SSE
+/// Four children starting at 'offset' with one SSE test.
+inline unsigned int intersect4(const float* bounds, size_t offset, size_t stride, const __m128* origin, const __m128* invDir, __m128 tmin, __m128 tmax, float* tmins) {
+    __m128 tnear = tmin;
+    __m128 tfar = tmax;
+    for (int a = 0; a < 3; a++) {
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds + a * stride + offset), origin[a]), invDir[a]);
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds + (a + 3) * stride + offset), origin[a]), invDir[a]);
+        tnear = _mm_max_ps(tnear, _mm_min_ps(t1, t2));
+        tfar  = _mm_min_ps(tfar,  _mm_max_ps(t1, t2));
+    }
+    _mm_storeu_ps(tmins + offset, tnear);
+    return (unsigned int)_mm_movemask_ps(_mm_cmple_ps(tnear, tfar));
+}
+
+template <>
+inline unsigned int intersectChildren<4>(const WideBVHNode<4>& node, const Ray& ray, float tmin, float tmax, float* tmins) {
+    __m128 origin[3] = { _mm_set1_ps(ray.origin.x), _mm_set1_ps(ray.origin.y), _mm_set1_ps(ray.origin.z) };
+    __m128 invDir[3] = { _mm_set1_ps(ray.inv_dir.x), _mm_set1_ps(ray.inv_dir.y), _mm_set1_ps(ray.inv_dir.z) };
+    unsigned int mask = intersect4(&node.bounds[0][0], 0, 4, origin, invDir, _mm_set1_ps(tmin), _mm_set1_ps(tmax), tmins);
+    return mask & ((1u << node.numOfChildren) - 1);
+}
+
+template <>
+inline unsigned int intersectChildren<8>(const WideBVHNode<8>& node, const Ray& ray, float tmin, float tmax, float* tmins) {
+#ifdef __AVX__
+    __m256 tnear = _mm256_set1_ps(tmin);
+    __m256 tfar = _mm256_set1_ps(tmax);
+    for (int a = 0; a < 3; a++) {
+        __m256 origin = _mm256_set1_ps(ray.origin[a]);
+        __m256 invDir = _mm256_set1_ps(ray.inv_dir[a]);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[a]), origin), invDir);
+        __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[a + 3]), origin), invDir);
+        tnear = _mm256_max_ps(tnear, _mm256_min_ps(t1, t2));
+        tfar  = _mm256_min_ps(tfar,  _mm256_max_ps(t1, t2));
+    }
+    _mm256_storeu_ps(tmins, tnear);
+    unsigned int mask = (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(tnear, tfar, _CMP_LE_OQ));
+#else
+    // Without AVX, two SSE tests
+    __m128 origin[3] = { _mm_set1_ps(ray.origin.x), _mm_set1_ps(ray.origin.y), _mm_set1_ps(ray.origin.z) };
+    __m128 invDir[3] = { _mm_set1_ps(ray.inv_dir.x), _mm_set1_ps(ray.inv_dir.y), _mm_set1_ps(ray.inv_dir.z) };
+    const float* bounds = &node.bounds[0][0];
+    unsigned int mask = intersect4(bounds, 0, 8, origin, invDir, _mm_set1_ps(tmin), _mm_set1_ps(tmax), tmins);
+    if (node.numOfChildren > 4)
+        mask |= intersect4(bounds, 4, 8, origin, invDir, _mm_set1_ps(tmin), _mm_set1_ps(tmax), tmins) << 4;
+#endif
+    return mask & ((1u << node.numOfChildren) - 1);
+}
+#endif
+
+}
+
+
+template <size_t N>
+void WideBVH<N>::init(const std::shared_ptr<Scene> scenePtr, BVHSplitMethod splitMethod) {
+    // The binary tree is only needed during the construction
+    BVH bvh;
+    bvh.init(scenePtr, splitMethod);
+    init(scenePtr, bvh);
+}
+
+template <size_t N>
+void WideBVH<N>::init(const std::shared_ptr<Scene>& scenePtr, const BVH& bvh) {
+    clear();
+    if (bvh.child_left == nullptr && bvh.box.triangles.empty()) return; // Empty scene
+
+    nodes.reserve(bvh.numOfNodes() / (N - 1) + 1);
+    collapse(bvh);
+
+    // Prepare the triangles in leaf order
+    LinearBVH::precomputeTriangles(scenePtr, triangles, precomputedTriangles);
+}
+
+template <size_t N>
+void WideBVH<N>::clear() {
+    nodes.clear();
+    triangles.clear();
+    precomputedTriangles.clear();
+}
+
+template <size_t N>
+void WideBVH<N>::refit(const std::shared_ptr<Scene>& scenePtr) {
+    LinearBVH::precomputeTriangles(scenePtr, triangles, precomputedTriangles);
+
+    // Children are stored after their parent, so a reverse sweep visits them first
+    for (size_t n = nodes.size(); n-- > 0;) {
+        WideBVHNode<N>& node = nodes[n];
+        for (size_t i = 0; i < node.numOfChildren; i++) {
+            glm::vec3 cornerDown = glm::vec3(std::numeric_limits<float>::max());
+            glm::vec3 cornerUp = glm::vec3(std::numeric_limits<float>::lowest());
+            if (node.children[i] & WIDE_BVH_LEAF) {
+                uint32_t first = node.children[i] & ~WIDE_BVH_LEAF;
+                for (uint32_t k = first; k < first + node.numOfTriangles[i]; k++)
+                    BVH::extendToTriangle(scenePtr, triangles[k].mesh_index, triangles[k].triangle_index, cornerDown, cornerUp);
+            }
+            else computeBounds(node.children[i], cornerDown, cornerUp);
+            for (int a = 0; a < 3; a++) {
+                node.bounds[a][i]     = cornerDown[a];
+                node.bounds[a + 3][i] = cornerUp[a];
+            }
+        }
+    }
+}
+
+template <size_t N>
+void WideBVH<N>::computeBounds(size_t nodeIndex, glm::vec3& cornerDown, glm::vec3& cornerUp) const {
+    const WideBVHNode<N>& node = nodes[nodeIndex];
+    cornerDown = glm::vec3(std::numeric_limits<float>::max());
+    cornerUp = glm::vec3(std::numeric_limits<float>::lowest());
+    for (size_t i = 0; i < node.numOfChildren; i++) {
+        for (int a = 0; a < 3; a++) {
+            cornerDown[a] = std::min(cornerDown[a], node.bounds[a][i]);
+            cornerUp[a]   = std::max(cornerUp[a],   node.bounds[a + 3][i]);
+        }
+    }
+}
+
+template <size_t N>
+float WideBVH<N>::computeSAHCost() const {
+    if (nodes.empty()) return 0.0f;
+    glm::vec3 rootDown, rootUp;
+    computeBounds(0, rootDown, rootUp);
+    float rootArea = AABBox::area(rootDown, rootUp);
+    if (rootArea <= 0.0f) return 0.0f;
+
+    // The root is always traversed, the other nodes when the ray enters the box stored in their parent
+    float cost = BVH_TRAVERSAL_COST;
+    for (const WideBVHNode<N>& node : nodes) {
+        for (size_t i = 0; i < node.numOfChildren; i++) {
+            glm::vec3 cornerDown(node.bounds[0][i], node.bounds[1][i], node.bounds[2][i]);
+            glm::vec3 cornerUp(node.bounds[3][i], node.bounds[4][i], node.bounds[5][i]);
+            float relativeArea = AABBox::area(cornerDown, cornerUp) / rootArea;
+            if (node.children[i] & WIDE_BVH_LEAF) cost += BVH_INTERSECTION_COST * node.numOfTriangles[i] * relativeArea;
+            else cost += BVH_TRAVERSAL_COST * relativeArea;
+        }
+    }
+    return cost;
+}
+
+template <size_t N>
+uint32_t WideBVH<N>::collapse(const BVH& bvh) {
+    // Open the internal child with the largest surface until there are N children
+    std::vector<const BVH*> children;
+    if (bvh.child_left == nullptr) children.push_back(&bvh); // The root is a single leaf
+    else {
+        children.push_back(bvh.child_left);
+        children.push_back(bvh.child_right);
+    }
+    while (children.size() < N) {
+        int best = -1;
+        float bestArea = -1.0f;
+        for (size_t i = 0; i < children.size(); i++) {
+            if (children[i]->child_left != nullptr && children[i]->box.area() > bestArea) {
+                bestArea = children[i]->box.area();
+                best = (int)i;
+            }
+        }
+        if (best == -1) break;
+        const BVH* opened = children[best];
+        children[best] = opened->child_left;
+        children.push_back(opened->child_right);
+    }
+
+    uint32_t nodeIndex = (uint32_t)nodes.size();
+    nodes.emplace_back();
+    WideBVHNode<N>& node = nodes.back();
+    for (size_t i = 0; i < N; i++) {
+        for (int a = 0; a < 6; a++) node.bounds[a][i] = 0.0f;
+        node.children[i] = 0;
+        node.numOfTriangles[i] = 0;
+    }
+    node.numOfChildren = (uint8_t)children.size();
+
+    for (size_t i = 0; i < children.size(); i++) {
+        const BVH* child = children[i];
+        uint32_t reference;
+        uint8_t numOfTriangles = 0;
+        if (child->child_left == nullptr) { // If it's a leaf
+            reference = WIDE_BVH_LEAF | (uint32_t)triangles.size();
+            numOfTriangles = (uint8_t)child->box.triangles.size();
+            for (const std::pair<size_t, size_t>& pair : child->box.triangles)
+                triangles.push_back({ (uint32_t)pair.first, (uint32_t)pair.second });
+        }
+        else reference = collapse(*child);
+
+        // The vector may have been reallocated
+        WideBVHNode<N>& current = nodes[nodeIndex];
+        for (int a = 0; a < 3; a++) {
+            current.bounds[a][i]     = child->box.cornerDown[a];
+            current.bounds[a + 3][i] = child->box.cornerUp[a];
+        }
+        current.children[i] = reference;
+        current.numOfTriangles[i] = numOfTriangles;
+    }
+    return nodeIndex;
+}
+
+
+template <size_t N>
+bool WideBVH<N>::intersect(RayHit& rayHit, const Ray& ray, size_t& mesh_index, size_t& triangle_index) const {
+    if (nodes.empty()) return false;
+
+    struct StackEntry {
+        uint32_t reference;
+        uint32_t numOfTriangles;
+        float tmin;
+    };
+    StackEntry stack[BVH_MAX_DEPTH * N];
+    size_t stackSize = 0;
+    stack[stackSize++] = { 0, 0, 0.0f };
+
+    const PrecomputedTriangle* trianglesPtr = precomputedTriangles.data();
+    uint32_t hitTriangle = 0;
+    bool hit = false;
+    float tmins[N];
+    while (stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+        if (entry.tmin >= rayHit.t) continue; // We won't find a closer intersection there
+
+        if (entry.reference & WIDE_BVH_LEAF) {
+            uint32_t first = entry.reference & ~WIDE_BVH_LEAF;
+            size_t hitIndex = 0;
+            if (PrecomputedTriangle::intersect(trianglesPtr + first, entry.numOfTriangles, rayHit, ray, hitIndex)) {
+                hitTriangle = first + (uint32_t)hitIndex;
+                hit = true;
+            }
+            continue;
+        }
+
+        const WideBVHNode<N>& node = nodes[entry.reference];
+        unsigned int mask = intersectChildren<N>(node, ray, 0.0f, rayHit.t, tmins);
+
+        // Sort the children hit by distance, the closest one is pushed last to be visited first
+        StackEntry ordered[N];
+        size_t count = 0;
+        for (size_t i = 0; i < N; i++) {
+            if (!(mask & (1u << i))) continue;
+            StackEntry child = { node.children[i], node.numOfTriangles[i], tmins[i] };
+            size_t j = count++;
+            while (j > 0 && ordered[j - 1].tmin < child.tmin) {
+                ordered[j] = ordered[j - 1];
+                j--;
+            }
+            ordered[j] = child;
+        }
+        for (size_t i = 0; i < count; i++) stack[stackSize++] = ordered[i];
+    }
+
+    // The indices in the scene are only needed for the closest triangle
+    if (hit) {
+        mesh_index = triangles[hitTriangle].mesh_index;
+        triangle_index = triangles[hitTriangle].triangle_index;
+    }
+    return hit;
+}
+
+template <size_t N>
+bool WideBVH<N>::fastIntersect(const Ray& ray, float tmin, float tmax) const {
+    if (nodes.empty()) return false;
+    const PrecomputedTriangle* trianglesPtr = precomputedTriangles.data();
+
+    uint32_t stack[BVH_MAX_DEPTH * N];
+    uint8_t stackTriangles[BVH_MAX_DEPTH * N];
+    size_t stackSize = 0;
+    stack[stackSize] = 0;
+    stackTriangles[stackSize++] = 0;
+
+    float tmins[N];
+    while (stackSize > 0) {
+        stackSize--;
+        uint32_t reference = stack[stackSize];
+        if (reference & WIDE_BVH_LEAF) {
+            if (PrecomputedTriangle::fastIntersect(trianglesPtr + (reference & ~WIDE_BVH_LEAF), stackTriangles[stackSize], ray, tmin, tmax)) return true;
+            continue;
+        }
+
+        // Any hit will do, so the children are not sorted
+        const WideBVHNode<N>& node = nodes[reference];
+        unsigned int mask = intersectChildren<N>(node, ray, tmin, tmax, tmins);
+        for (size_t i = 0; i < N; i++) {
+            if (!(mask & (1u << i))) continue;
+            stack[stackSize] = node.children[i];
+            stackTriangles[stackSize++] = node.numOfTriangles[i];
+        }
+    }
+    return false;
+}
+
+
+template class WideBVH<4>;
+template class WideBVH<8>;
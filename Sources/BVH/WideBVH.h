@@ -0,0 +1,65 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <vector>
+#include <cstdint>
+
+#include "AABBox.h"
+#include "BVH.h"
+#include "PrecomputedTriangle.h"
+#include "LinearBVH.h"
+#include "../Ray.h"
+#include "../Scene.h"
+
+
+static const uint32_t WIDE_BVH_LEAF (0x80000000u); // Set on a child which refers to triangles
+
+/// Node with the boxes of its N children stored as structure of arrays, so a single SIMD slab test covers all of them.
+template <size_t N>
+struct alignas(32) WideBVHNode {
+    float bounds[6][N];          // Min x, y, z then max x, y, z of every child
+    uint32_t children[N];        // Node index, or WIDE_BVH_LEAF | first triangle
+    uint8_t numOfTriangles[N];   // 0 for an internal child
+    uint8_t numOfChildren;       // Children are packed first, the other slots are unused
+};
+
+
+/// N-ary BVH obtained by collapsing the levels of a binary BVH (N = 4 for SSE, 8 for AVX).
+template <size_t N>
+class WideBVH {
+
+public:
+    WideBVH() {};
+    void init(const std::shared_ptr<Scene> scenePtr, BVHSplitMethod splitMethod = BVHSplitMethod::SAH);
+    void init(const std::shared_ptr<Scene>& scenePtr, const BVH& bvh);
+    void clear();
+    /// Updates the triangles and the boxes of the children after the vertices of the meshes moved, the nodes are kept.
+    void refit(const std::shared_ptr<Scene>& scenePtr);
+
+    bool intersect(RayHit& rayHit, const Ray& ray, size_t& mesh_index, size_t& triangle_index) const;
+    /// Any hit at a distance in [tmin, tmax).
+    bool fastIntersect(const Ray& ray, float tmin = 0.0f, float tmax = std::numeric_limits<float>::max()) const;
+
+    /// SAH cost of the nodes, relative to the surface of the root box. Each node is traversed once for all its children.
+    float computeSAHCost() const;
+    inline size_t numOfNodes() const { return nodes.size(); }
+    /// Union of the boxes of the children of a node, the nodes do not store their own box.
+    void computeBounds(size_t nodeIndex, glm::vec3& cornerDown, glm::vec3& cornerUp) const;
+    inline size_t memoryUsage() const { return nodes.size() * sizeof(WideBVHNode<N>) + triangles.size() * (sizeof(LinearBVHTriangle) + sizeof(PrecomputedTriangle)); }
+
+    std::vector<WideBVHNode<N>> nodes;
+    std::vector<LinearBVHTriangle> triangles;
+    std::vector<PrecomputedTriangle> precomputedTriangles; // In the order of 'triangles'
+
+private:
+    uint32_t collapse(const BVH& bvh);
+};
+
+typedef WideBVH<4> BVH4;
+typedef WideBVH<8> BVH8;
@@ -0,0 +1,8 @@
+#include "DirectIntegrator.h"
+
+#include "../RayTracer.h"
+
+
+glm::vec3 DirectIntegrator::radiance(RayTracer& rayTracer, const std::shared_ptr<Scene>& scenePtr, ShadingPoint& point, const glm::mat4& normalMat, uint32_t pixelIndex, uint32_t sampleIndex) const {
+    return rayTracer.directLighting(scenePtr, point, normalMat, pixelIndex, sampleIndex);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "Integrator.h"
+
+
+/// Light coming straight from the light sources, as shaded by RayTracer::directLighting.
+class DirectIntegrator : public Integrator {
+
+public:
+    glm::vec3 radiance(RayTracer& rayTracer, const std::shared_ptr<Scene>& scenePtr, ShadingPoint& point, const glm::mat4& normalMat, uint32_t pixelIndex, uint32_t sampleIndex) const override;
+};
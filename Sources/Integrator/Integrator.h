@@ -0,0 +1,50 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include "../Material.h"
+
+class RayTracer;
+class Scene;
+
+
+/// Surface seen by a ray, in view space for the shading and in world space for the shadow rays.
+struct ShadingPoint {
+    std::shared_ptr<Material> material;
+    glm::vec3 fPosition;
+    glm::vec3 fNormal;
+    glm::vec3 w0;            // Towards the eye or the previous vertex of a path, in view space
+    glm::vec3 worldPosition; // Only with the occlusion, point lights or secondary rays
+    glm::vec3 worldNormal;   // Geometric normal, only with the occlusion or secondary rays
+    float offset = 0.0f;     // Of the shadow rays and secondary rays off the surface
+};
+
+
+/// Light carried back along a camera ray by the surface it hits. The ray tracer traces the camera rays,
+/// whatever the renderer (tiles, packets, adaptive or progressive), and hands their hits to its integrator.
+class Integrator {
+
+public:
+    virtual ~Integrator() {}
+
+    /// Light leaving 'point' towards 'point.w0'. 'pixelIndex' and 'sampleIndex' seed the random choices.
+    virtual glm::vec3 radiance(RayTracer& rayTracer, const std::shared_ptr<Scene>& scenePtr, ShadingPoint& point, const glm::mat4& normalMat, uint32_t pixelIndex, uint32_t sampleIndex) const = 0;
+
+    /// Whether the integrator traces rays past the camera hit, the shading points then needing their world space frame.
+    /// The wavefront renderer has its own stages for the direct lighting and only stands for integrators which do not.
+    virtual bool tracesSecondaryRays() const { return false; }
+
+    /// Counters of what the integrator did, which RayTracer::render resets before a rendering and prints after it.
+    virtual void resetStatistics() {}
+    /// Empty without any counter.
+    virtual std::string statistics() const { return ""; }
+};
@@ -0,0 +1,207 @@
+#include "PathIntegrator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+
+#include "../RayTracer.h"
+#include "../BRDF.h"
+
+
+namespace {
+
+/// Tangent and bitangent completing 'n' into an orthonormal basis (Duff et al. 2017).
+inline void basis(const glm::vec3& n, glm::vec3& t, glm::vec3& b) {
+    float sign = std::copysign(1.0f, n.z);
+    float a = -1.0f / (sign + n.z);
+    float c = n.x * n.y * a;
+    t = glm::vec3(1.0f + sign * n.x * n.x * a, sign * c, -sign * n.x);
+    b = glm::vec3(c, sign + n.y * n.y * a, -n.y);
+}
+
+/// Weight of a sample drawn with the density 'pdf' against another strategy drawing it with 'otherPdf'.
+inline float powerHeuristic(float pdf, float otherPdf) {
+    float pdf2 = pdf * pdf;
+    return pdf2 / (pdf2 + otherPdf * otherPdf);
+}
+
+}
+
+
+float PathIntegrator::specularProbability(const Material& material) {
+    glm::vec3 albedo = material.albedo();
+    glm::vec3 F0 = albedo + (glm::vec3(1.0f) - albedo) * material.metallicness();
+    float specular = std::max({ F0.x, F0.y, F0.z });
+    float diffuse = std::max({ albedo.x, albedo.y, albedo.z });
+    if (specular + diffuse <= 0.0f) return 0.5f;
+    // Neither lobe is ever left out, the other one would then bring its light with an infinite weight
+    return std::min(0.9f, std::max(0.1f, specular / (specular + diffuse)));
+}
+
+bool PathIntegrator::sampleBRDF(const ShadingPoint& point, float lobe, const glm::vec2& u, glm::vec3& wi) {
+    const glm::vec3& n = point.fNormal;
+    glm::vec3 t, b;
+    basis(n, t, b);
+    float phi = 2.0f * glm::pi<float>() * u.y;
+    if (lobe < specularProbability(*point.material)) {
+        // Half vector over D(wh) (n.wh), mirrored around it
+        float alpha = std::max(point.material->roughness(), PATH_MIN_ROUGHNESS);
+        float alpha2 = alpha * alpha;
+        float cosTheta = std::sqrt((1.0f - u.x) / (1.0f + (alpha2 - 1.0f) * u.x));
+        float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+        glm::vec3 wh = (std::cos(phi) * sinTheta) * t + (std::sin(phi) * sinTheta) * b + cosTheta * n;
+        wi = 2.0f * glm::dot(point.w0, wh) * wh - point.w0;
+    }
+    else {
+        float r = std::sqrt(u.x);
+        wi = (r * std::cos(phi)) * t + (r * std::sin(phi)) * b + std::sqrt(std::max(0.0f, 1.0f - u.x)) * n;
+    }
+    return glm::dot(n, wi) > 0.0f;
+}
+
+float PathIntegrator::pdfBRDF(const ShadingPoint& point, const glm::vec3& wi) {
+    const glm::vec3& n = point.fNormal;
+    float cosine = glm::dot(n, wi);
+    if (cosine <= 0.0f) return 0.0f;
+    float diffusePdf = cosine * glm::one_over_pi<float>();
+
+    float specularPdf = 0.0f;
+    glm::vec3 wh = glm::normalize(wi + point.w0);
+    float w0_wh = glm::dot(point.w0, wh);
+    if (w0_wh > 0.0f) {
+        float alpha = std::max(point.material->roughness(), PATH_MIN_ROUGHNESS);
+        float alpha2 = alpha * alpha;
+        float n_wh = std::max(0.0f, glm::dot(n, wh));
+        float d = 1.0f + (alpha2 - 1.0f) * n_wh * n_wh;
+        float D = alpha2 / (glm::pi<float>() * d * d);
+        specularPdf = D * n_wh / (4.0f * w0_wh);
+    }
+    float p = specularProbability(*point.material);
+    return p * specularPdf + (1.0f - p) * diffusePdf;
+}
+
+glm::vec3 PathIntegrator::radiance(RayTracer& rayTracer, const std::shared_ptr<Scene>& scenePtr, ShadingPoint& cameraPoint, const glm::mat4& cameraNormalMat, uint32_t pixelIndex, uint32_t sampleIndex) const {
+    const glm::vec3 backgroundColor = scenePtr->backgroundColor();
+    const bool withEnvironment = useEnvironmentLight && std::max({ backgroundColor.x, backgroundColor.y, backgroundColor.z }) > 0.0f;
+    const glm::mat4& viewToWorld = rayTracer.viewToWorld();
+    glm::vec3 L(0.0f);
+    glm::vec3 throughput(1.0f);
+    ShadingPoint point = cameraPoint;
+    glm::mat4 normalMat = cameraNormalMat;
+
+    // Ray leaving the current surface towards 'wi', in view space
+    auto leavingRay = [&](const glm::vec3& wi) {
+        glm::vec3 direction = glm::vec3(viewToWorld * glm::vec4(wi, 0.0f));
+        float side = (glm::dot(point.worldNormal, direction) >= 0.0f) ? 1.0f : -1.0f;
+        return Ray(point.worldPosition + side * point.offset * point.worldNormal, direction);
+    };
+    auto brdf = [&](glm::vec3 wi) {
+        glm::vec3 wh = glm::normalize(wi + point.w0);
+        return BRDF::diffuse(*point.material) + BRDF::specular(*point.material, point.w0, wi, wh, point.fNormal);
+    };
+
+    size_t depth = 0;
+    PathEnd end = MaxDepth;
+    for (; depth < maxDepth; depth++) {
+        // The surfaces are lit from both sides
+        if (glm::dot(point.fNormal, point.w0) < 0.0f) point.fNormal = -point.fNormal;
+        const uint32_t dimension = (uint32_t)depth * PATH_DIMENSIONS_PER_BOUNCE;
+
+        // Next event estimation of the light sources, which no direction drawn from the BRDF can hit
+        L += throughput * rayTracer.directLighting(scenePtr, point, normalMat, pixelIndex, sampleIndex, LIGHT_SAMPLE_DIMENSION + (uint32_t)(depth * rayTracer.lightSamples));
+
+        // and of the environment, over the cosine
+        if (withEnvironment) {
+            glm::vec3 wi;
+            glm::vec2 u = m_sampler.get2D(pixelIndex, sampleIndex, dimension);
+            glm::vec3 t, b;
+            basis(point.fNormal, t, b);
+            float r = std::sqrt(u.x);
+            float phi = 2.0f * glm::pi<float>() * u.y;
+            wi = (r * std::cos(phi)) * t + (r * std::sin(phi)) * b + std::sqrt(std::max(0.0f, 1.0f - u.x)) * point.fNormal;
+            float cosine = glm::dot(point.fNormal, wi);
+            if (cosine > 0.0f && (!rayTracer.useOcclusion || !rayTracer.fastIntersect(scenePtr, leavingRay(wi)))) {
+                float lightPdf = cosine * glm::one_over_pi<float>();
+                L += throughput * backgroundColor * brdf(wi) * (cosine / lightPdf) * powerHeuristic(lightPdf, pdfBRDF(point, wi));
+            }
+        }
+
+        // The path goes on in a direction drawn from the BRDF. From the last surface too, for the environment
+        // to be reached by both strategies
+        if (!withEnvironment && depth + 1 == maxDepth) break;
+        glm::vec3 wi;
+        float pdf = 0.0f;
+        if (sampleBRDF(point, m_sampler.get1D(pixelIndex, sampleIndex, dimension + 1), m_sampler.get2D(pixelIndex, sampleIndex, dimension + 2), wi)) pdf = pdfBRDF(point, wi);
+        if (pdf <= 0.0f) {
+            end = Absorbed;
+            break;
+        }
+        throughput *= brdf(wi) * (glm::dot(point.fNormal, wi) / pdf);
+
+        // Russian roulette on what the path still carries, the surviving paths making up for the ended ones
+        if (depth + 1 >= rouletteMinDepth) {
+            float survival = std::min(PATH_MAX_SURVIVAL, std::max({ throughput.x, throughput.y, throughput.z }));
+            if (m_sampler.get1D(pixelIndex, sampleIndex, dimension + 3) >= survival) {
+                end = Roulette;
+                break;
+            }
+            throughput /= survival;
+        }
+
+        RayHit rayHit;
+        size_t instance_index = 0;
+        size_t triangle_index = 0;
+        if (!rayTracer.intersect(scenePtr, rayHit, leavingRay(wi), instance_index, triangle_index)) {
+            if (withEnvironment) L += throughput * backgroundColor * powerHeuristic(pdf, glm::dot(point.fNormal, wi) * glm::one_over_pi<float>());
+            end = Escaped;
+            break;
+        }
+        if (depth + 1 == maxDepth) break;
+        normalMat = rayTracer.normalMatrix(instance_index);
+        point = rayTracer.shadingPoint(scenePtr, rayHit, instance_index, triangle_index, rayTracer.modelViewMatrix(instance_index), normalMat);
+        point.w0 = -wi;
+    }
+
+    const size_t numOfSurfaces = std::min(depth + 1, maxDepth);
+    m_pathLengths[std::min(numOfSurfaces, PATH_STATISTICS_DEPTH)].fetch_add(1, std::memory_order_relaxed);
+    m_pathEnds[end].fetch_add(1, std::memory_order_relaxed);
+    if (end == Roulette) m_rouletteEnds[std::min(numOfSurfaces, PATH_STATISTICS_DEPTH)].fetch_add(1, std::memory_order_relaxed);
+    return L;
+}
+
+void PathIntegrator::resetStatistics() {
+    for (size_t i = 0; i <= PATH_STATISTICS_DEPTH; i++) {
+        m_pathLengths[i] = 0;
+        m_rouletteEnds[i] = 0;
+    }
+    for (int i = 0; i < NumOfPathEnds; i++) m_pathEnds[i] = 0;
+}
+
+std::string PathIntegrator::statistics() const {
+    uint64_t numOfPaths = 0;
+    uint64_t numOfSurfaces = 0;
+    size_t longest = 0;
+    for (size_t i = 0; i <= PATH_STATISTICS_DEPTH; i++) {
+        numOfPaths += m_pathLengths[i];
+        numOfSurfaces += i * m_pathLengths[i];
+        if (m_pathLengths[i] > 0) longest = i;
+    }
+    if (numOfPaths == 0) return "";
+
+    auto percent = [&](uint64_t count) { return 100.0 * (double)count / (double)numOfPaths; };
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    out << "Paths: " << numOfPaths << ", " << std::setprecision(3) << (double)numOfSurfaces / (double)numOfPaths << std::setprecision(1)
+        << " surfaces on average, ended by escaping " << percent(m_pathEnds[Escaped]) << "%, absorption " << percent(m_pathEnds[Absorbed])
+        << "%, Russian roulette " << percent(m_pathEnds[Roulette]) << "%, the " << maxDepth << " surfaces limit " << percent(m_pathEnds[MaxDepth]) << "%";
+    // Share of the paths reaching a surface, and of them which the roulette ended there, down to the rare ones
+    out << "\n  surface: reached, ended by the roulette";
+    uint64_t numOfReaching = numOfPaths;
+    for (size_t i = 1; i <= longest && percent(numOfReaching) >= 0.05; i++) {
+        out << "\n  " << i << (i == PATH_STATISTICS_DEPTH ? "+" : "") << ": " << percent(numOfReaching) << "%, " << percent(m_rouletteEnds[i]) << "%";
+        numOfReaching -= m_pathLengths[i];
+    }
+    out << "\n  longest path: " << longest << (longest == PATH_STATISTICS_DEPTH ? "+" : "") << " surfaces";
+    return out.str();
+}
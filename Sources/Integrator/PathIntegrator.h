@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+
+#include "Integrator.h"
+#include "../Sampler.h"
+
+
+static const size_t PATH_MAX_DEPTH (8); // Surfaces hit by a path, the camera hit included
+static const size_t PATH_ROULETTE_DEPTH (3); // Surfaces hit by a path before Russian roulette may end it
+static const size_t PATH_STATISTICS_DEPTH (32); // Surfaces counted apart in the statistics, the longer paths being counted with the last ones
+static const float PATH_MAX_SURVIVAL (0.95f); // Probability of a path to go on at most, so that the bright ones end too
+static const uint32_t PATH_SAMPLER_SEED (1); // Of the sampler of the directions, apart from the anti-aliasing and the light picking
+static const uint32_t PATH_DIMENSIONS_PER_BOUNCE (4); // Sampler dimensions used at every surface of a path
+static const float PATH_MIN_ROUGHNESS (1e-3f); // Below it the GGX lobe is too sharp to sample in single precision
+
+
+/// Unidirectional path tracer: from every surface, the light sources are shaded directly (next event estimation)
+/// then the path goes on in a direction drawn from the BRDF, the diffuse lobe over the cosine and the GGX lobe
+/// over the distribution of normals. Past rouletteMinDepth surfaces, Russian roulette ends the paths in
+/// proportion to how little they carry, so a path costs about what it brings whatever maxDepth. The background
+/// color lights the scene as an environment, which both the next event estimation and the BRDF directions reach,
+/// their estimates being weighted by multiple importance sampling (power heuristic). The point and directional
+/// lights can only be reached by the former.
+class PathIntegrator : public Integrator {
+
+public:
+    glm::vec3 radiance(RayTracer& rayTracer, const std::shared_ptr<Scene>& scenePtr, ShadingPoint& point, const glm::mat4& normalMat, uint32_t pixelIndex, uint32_t sampleIndex) const override;
+    bool tracesSecondaryRays() const override { return true; }
+    /// Length of the paths and why they ended.
+    void resetStatistics() override;
+    std::string statistics() const override;
+
+    /// Direction 'wi', in view space, drawn from the BRDF of 'point': 'lobe' in [0,1) picks the diffuse or the specular lobe, 'u' in [0,1)^2 the direction.
+    /// Returns false for a direction under the surface.
+    static bool sampleBRDF(const ShadingPoint& point, float lobe, const glm::vec2& u, glm::vec3& wi);
+    /// Density, over the solid angle, of sampleBRDF drawing 'wi'.
+    static float pdfBRDF(const ShadingPoint& point, const glm::vec3& wi);
+
+    size_t maxDepth = PATH_MAX_DEPTH;
+    size_t rouletteMinDepth = PATH_ROULETTE_DEPTH; // Surfaces a path goes through before Russian roulette may end it, at most 1 for right after the camera hit
+    bool useEnvironmentLight = true; // The background color lights the scene from every direction, otherwise the paths leaving the scene bring nothing
+
+private:
+    enum PathEnd { Escaped, Absorbed, Roulette, MaxDepth, NumOfPathEnds };
+
+    /// Probability of sampleBRDF to pick the specular lobe, after the reflectance of each lobe.
+    static float specularProbability(const Material& material);
+
+    Sampler m_sampler = Sampler(SamplerType::Random, 1, PATH_SAMPLER_SEED);
+
+    // Statistics, added to once per path by all the threads
+    mutable std::atomic<uint64_t> m_pathLengths[PATH_STATISTICS_DEPTH + 1] = {}; // Paths by number of surfaces
+    mutable std::atomic<uint64_t> m_pathEnds[NumOfPathEnds] = {};
+    mutable std::atomic<uint64_t> m_rouletteEnds[PATH_STATISTICS_DEPTH + 1] = {}; // Paths ended by the roulette, by number of surfaces
+};
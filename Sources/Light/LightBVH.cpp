@@ -0,0 +1,97 @@
+#include "LightBVH.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include "../Scene.h"
+
+
+float LightBVH::influenceRadius(const LightSourcePoint& light, float cutoff) {
+    // Solves a_q d^2 + a_l d + a_c = intensity / cutoff
+    if (cutoff <= 0.0f) return std::numeric_limits<float>::infinity();
+    const float brightness = light.intensity * std::max({ light.color.r, light.color.g, light.color.b });
+    const float c = light.a_c - brightness / cutoff;
+    if (c >= 0.0f) return 0.0f; // Under the cutoff even on the light
+    if (light.a_q > 0.0f) return (-light.a_l + std::sqrt(light.a_l * light.a_l - 4.0f * light.a_q * c)) / (2.0f * light.a_q);
+    if (light.a_l > 0.0f) return -c / light.a_l;
+    return std::numeric_limits<float>::infinity();
+}
+
+void LightBVH::clear() {
+    m_nodes.clear();
+    m_lights.clear();
+    m_positions.clear();
+    m_squaredRadii.clear();
+    m_unboundedLights.clear();
+}
+
+void LightBVH::build(const std::shared_ptr<Scene>& scenePtr, float cutoff) {
+    clear();
+    std::vector<float> radii;
+    for (size_t i = 0; i < scenePtr->numOflightSourcesPoint(); i++) {
+        const LightSourcePoint& light = *scenePtr->lightSourcePoint(i);
+        float radius = influenceRadius(light, cutoff);
+        if (radius <= 0.0f) continue;
+        if (std::isinf(radius)) {
+            m_unboundedLights.push_back((uint32_t)i);
+            continue;
+        }
+        m_lights.push_back((uint32_t)i);
+        m_positions.push_back(light.position);
+        radii.push_back(radius);
+    }
+    if (m_lights.empty()) return;
+    m_nodes.reserve(2 * m_lights.size());
+    build(0, (uint32_t)m_lights.size(), radii);
+    m_squaredRadii.resize(radii.size());
+    for (size_t i = 0; i < radii.size(); i++) m_squaredRadii[i] = radii[i] * radii[i];
+}
+
+uint32_t LightBVH::build(uint32_t begin, uint32_t end, std::vector<float>& radii) {
+    const uint32_t nodeIndex = (uint32_t)m_nodes.size();
+    m_nodes.emplace_back();
+    glm::vec3 cornerDown = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 cornerUp = glm::vec3(std::numeric_limits<float>::lowest());
+    glm::vec3 centerMin = cornerDown;
+    glm::vec3 centerMax = cornerUp;
+    for (uint32_t i = begin; i < end; i++) {
+        cornerDown = glm::min(cornerDown, m_positions[i] - glm::vec3(radii[i]));
+        cornerUp = glm::max(cornerUp, m_positions[i] + glm::vec3(radii[i]));
+        centerMin = glm::min(centerMin, m_positions[i]);
+        centerMax = glm::max(centerMax, m_positions[i]);
+    }
+    m_nodes[nodeIndex].cornerDown = cornerDown;
+    m_nodes[nodeIndex].cornerUp = cornerUp;
+
+    if (end - begin <= LIGHT_BVH_LEAF_SIZE) {
+        m_nodes[nodeIndex].offset = begin;
+        m_nodes[nodeIndex].numOfLights = end - begin;
+        return nodeIndex;
+    }
+
+    // Median split of the light positions along their largest extent, the arrays being permuted together
+    const glm::vec3 extent = centerMax - centerMin;
+    const int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+    const uint32_t middle = begin + (end - begin) / 2;
+    std::vector<uint32_t> order(end - begin);
+    std::iota(order.begin(), order.end(), begin);
+    std::nth_element(order.begin(), order.begin() + (middle - begin), order.end(), [&](uint32_t a, uint32_t b) { return m_positions[a][axis] < m_positions[b][axis]; });
+    std::vector<uint32_t> lights(order.size());
+    std::vector<glm::vec3> positions(order.size());
+    std::vector<float> sortedRadii(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        lights[i] = m_lights[order[i]];
+        positions[i] = m_positions[order[i]];
+        sortedRadii[i] = radii[order[i]];
+    }
+    std::copy(lights.begin(), lights.end(), m_lights.begin() + begin);
+    std::copy(positions.begin(), positions.end(), m_positions.begin() + begin);
+    std::copy(sortedRadii.begin(), sortedRadii.end(), radii.begin() + begin);
+
+    build(begin, middle, radii);
+    m_nodes[nodeIndex].offset = build(middle, end, radii);
+    m_nodes[nodeIndex].numOfLights = 0;
+    return nodeIndex;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "LightSourcePoint.h"
+
+class Scene;
+
+
+static const float POINT_LIGHT_CUTOFF (1.0f / 1024.0f); // Attenuated intensity, times the strongest color channel, under which a point light is skipped
+static const size_t LIGHT_BVH_LEAF_SIZE (4);
+
+/// Node of a LightBVH, the left child following its parent in the array.
+struct LightBVHNode {
+    glm::vec3 cornerDown;
+    uint32_t offset; // First light of a leaf, right child otherwise
+    glm::vec3 cornerUp;
+    uint32_t numOfLights; // 0 for an inner node
+};
+
+/// Hierarchy over the spheres of influence of the point lights of a scene, in world space. Beyond its radius,
+/// the attenuated intensity of a light falls under the cutoff, so a shading point only visits the lights around it.
+/// The lights without a distance attenuation have no such radius and always light.
+class LightBVH {
+
+public:
+    void build(const std::shared_ptr<Scene>& scenePtr, float cutoff = POINT_LIGHT_CUTOFF);
+    void clear();
+
+    /// Distance beyond which the light, as attenuated by a_c + a_l d + a_q d^2, is under 'cutoff'. Infinite without attenuation.
+    static float influenceRadius(const LightSourcePoint& light, float cutoff);
+
+    /// Calls 'f' with the index of every point light which may light 'position', in world space.
+    template <typename F>
+    void forEachLight(const glm::vec3& position, F f) const {
+        for (uint32_t light : m_unboundedLights) f(light);
+        if (m_nodes.empty()) return;
+        uint32_t stack[64];
+        size_t stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            const LightBVHNode& node = m_nodes[stack[--stackSize]];
+            if (glm::any(glm::lessThan(position, node.cornerDown)) || glm::any(glm::greaterThan(position, node.cornerUp))) continue;
+            if (node.numOfLights > 0) {
+                for (uint32_t i = node.offset; i < node.offset + node.numOfLights; i++) {
+                    glm::vec3 d = position - m_positions[i];
+                    if (glm::dot(d, d) <= m_squaredRadii[i]) f(m_lights[i]);
+                }
+            }
+            else {
+                stack[stackSize++] = node.offset;
+                stack[stackSize++] = (uint32_t)(&node - m_nodes.data()) + 1;
+            }
+        }
+    }
+
+    inline size_t numOfBoundedLights() const { return m_lights.size(); }
+    inline size_t numOfUnboundedLights() const { return m_unboundedLights.size(); }
+
+private:
+    uint32_t build(uint32_t begin, uint32_t end, std::vector<float>& radii);
+
+    std::vector<LightBVHNode> m_nodes;
+    // Per light slot, in the order of the leaves
+    std::vector<uint32_t> m_lights;
+    std::vector<glm::vec3> m_positions;
+    std::vector<float> m_squaredRadii;
+    std::vector<uint32_t> m_unboundedLights;
+};
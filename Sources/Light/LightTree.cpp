@@ -0,0 +1,145 @@
+#include "LightTree.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+#include "../Scene.h"
+
+
+static const float LIGHT_TREE_MIN_DISTANCE (1e-4f); // Keeps the estimate of a light finite at its own position
+static const float LIGHT_TREE_MIN_ATTENUATION (1e-8f); // And the one of a light without attenuation
+
+inline float brightness(float intensity, const glm::vec3& color) {
+    return intensity * std::max({ color.r, color.g, color.b });
+}
+
+float LightTree::estimate(const LightSourcePoint& light, const glm::vec3& position) {
+    float d = std::max(LIGHT_TREE_MIN_DISTANCE, glm::distance(light.position, position));
+    return brightness(light.intensity, light.color) / std::max(LIGHT_TREE_MIN_ATTENUATION, light.a_c + light.a_l * d + light.a_q * d * d);
+}
+
+float LightTree::estimate(const LightSourceDir& light) {
+    return brightness(light.intensity, light.color);
+}
+
+void LightTree::clear() {
+    m_nodes.clear();
+    m_directionalCDF.clear();
+    m_numOfLightSourcesDir = 0;
+}
+
+void LightTree::build(const std::shared_ptr<Scene>& scenePtr) {
+    clear();
+    m_numOfLightSourcesDir = scenePtr->numOfLightSourcesDir();
+    float sum = 0.0f;
+    for (size_t i = 0; i < m_numOfLightSourcesDir; i++) {
+        sum += estimate(*scenePtr->lightSourceDir(i));
+        m_directionalCDF.push_back(sum);
+    }
+    if (sum <= 0.0f) m_directionalCDF.clear();
+
+    std::vector<uint32_t> lights;
+    std::vector<glm::vec3> positions;
+    std::vector<float> powers;
+    std::vector<glm::vec3> attenuations;
+    for (size_t i = 0; i < scenePtr->numOflightSourcesPoint(); i++) {
+        const LightSourcePoint& light = *scenePtr->lightSourcePoint(i);
+        float power = brightness(light.intensity, light.color);
+        if (power <= 0.0f) continue;
+        lights.push_back((uint32_t)i);
+        positions.push_back(light.position);
+        powers.push_back(power);
+        attenuations.push_back(glm::vec3(light.a_c, light.a_l, light.a_q));
+    }
+    if (lights.empty()) return;
+    m_nodes.reserve(2 * lights.size());
+    build(lights, 0, (uint32_t)lights.size(), positions, powers, attenuations);
+}
+
+uint32_t LightTree::build(std::vector<uint32_t>& lights, uint32_t begin, uint32_t end, const std::vector<glm::vec3>& positions, const std::vector<float>& powers, const std::vector<glm::vec3>& attenuations) {
+    const uint32_t nodeIndex = (uint32_t)m_nodes.size();
+    m_nodes.emplace_back();
+    LightTreeNode node;
+    node.cornerDown = glm::vec3(std::numeric_limits<float>::max());
+    node.cornerUp = glm::vec3(std::numeric_limits<float>::lowest());
+    node.attenuation = glm::vec3(std::numeric_limits<float>::max());
+    node.power = 0.0f;
+    for (uint32_t i = begin; i < end; i++) {
+        node.cornerDown = glm::min(node.cornerDown, positions[lights[i]]);
+        node.cornerUp = glm::max(node.cornerUp, positions[lights[i]]);
+        node.attenuation = glm::min(node.attenuation, attenuations[lights[i]]);
+        node.power += powers[lights[i]];
+    }
+
+    if (end - begin == 1) {
+        node.offset = lights[begin];
+        node.isLeaf = 1;
+        m_nodes[nodeIndex] = node;
+        return nodeIndex;
+    }
+
+    // Median split along the largest extent, so that the boxes stay tight around groups of lights
+    const glm::vec3 extent = node.cornerUp - node.cornerDown;
+    const int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+    const uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(lights.begin() + begin, lights.begin() + middle, lights.begin() + end, [&](uint32_t a, uint32_t b) { return positions[a][axis] < positions[b][axis]; });
+
+    build(lights, begin, middle, positions, powers, attenuations);
+    node.offset = build(lights, middle, end, positions, powers, attenuations);
+    node.isLeaf = 0;
+    m_nodes[nodeIndex] = node;
+    return nodeIndex;
+}
+
+float LightTree::importance(const LightTreeNode& node, const glm::vec3& position) const {
+    // Distance to the center of the box, but no less than half its diagonal: the distance to the box would be
+    // close to zero for all the nodes around 'position', whose lights then get no better than equal chances
+    const glm::vec3 center = 0.5f * (node.cornerDown + node.cornerUp);
+    const float halfDiagonal = 0.5f * glm::length(node.cornerUp - node.cornerDown);
+    float d = std::max({ LIGHT_TREE_MIN_DISTANCE, halfDiagonal, glm::length(position - center) });
+    return node.power / std::max(LIGHT_TREE_MIN_ATTENUATION, node.attenuation.x + node.attenuation.y * d + node.attenuation.z * d * d);
+}
+
+bool LightTree::sample(const glm::vec3& position, float uf, size_t& lightIndex, float& pdf) const {
+    if (empty()) return false;
+    pdf = 1.0f;
+    double u = uf; // Rescaled at every choice, in double so that the deep choices keep enough bits
+
+    // Directional lights against the point lights
+    const float directionalPower = m_directionalCDF.empty() ? 0.0f : m_directionalCDF.back();
+    const float pointPower = m_nodes.empty() ? 0.0f : importance(m_nodes[0], position);
+    const float directionalProbability = directionalPower / (directionalPower + pointPower);
+    if (u < directionalProbability) {
+        float power = (float)(u / directionalProbability * directionalPower);
+        size_t i = std::upper_bound(m_directionalCDF.begin(), m_directionalCDF.end(), power) - m_directionalCDF.begin();
+        lightIndex = std::min(i, m_directionalCDF.size() - 1);
+        pdf = directionalProbability * (m_directionalCDF[lightIndex] - (lightIndex > 0 ? m_directionalCDF[lightIndex - 1] : 0.0f)) / directionalPower;
+        return true;
+    }
+    pdf = 1.0f - directionalProbability;
+    u = std::min((u - directionalProbability) / pdf, 1.0 - 1e-12);
+
+    // Down the tree
+    uint32_t nodeIndex = 0;
+    while (!m_nodes[nodeIndex].isLeaf) {
+        const uint32_t left = nodeIndex + 1;
+        const uint32_t right = m_nodes[nodeIndex].offset;
+        const float leftImportance = importance(m_nodes[left], position);
+        const float rightImportance = importance(m_nodes[right], position);
+        const float leftProbability = leftImportance / (leftImportance + rightImportance);
+        if (u < leftProbability) {
+            u = u / leftProbability;
+            pdf *= leftProbability;
+            nodeIndex = left;
+        }
+        else {
+            u = (u - leftProbability) / (1.0f - leftProbability);
+            pdf *= 1.0f - leftProbability;
+            nodeIndex = right;
+        }
+        u = std::min(u, 1.0 - 1e-12);
+    }
+    lightIndex = m_numOfLightSourcesDir + m_nodes[nodeIndex].offset;
+    return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/gtx/string_cast.hpp>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "LightSourceDir.h"
+#include "LightSourcePoint.h"
+
+class Scene;
+
+
+/// Node of a LightTree, the left child following its parent in the array.
+struct LightTreeNode {
+    glm::vec3 cornerDown;
+    float power; // Sum of the intensities times the strongest color channel
+    glm::vec3 cornerUp;
+    uint32_t offset; // Point light of a leaf, right child otherwise
+    glm::vec3 attenuation; // Smallest a_c, a_l, a_q of the lights
+    uint32_t isLeaf;
+};
+
+/// Binary tree over the point lights of a scene, to pick a light at random in proportion to an estimate of
+/// what it brings to a shading point: the power of a node attenuated at the distance of its center. A pick walks
+/// down one branch, so it costs O(log lights) whatever their number. The directional lights, which do not
+/// fade with the distance, are picked in proportion to their power against the whole tree.
+class LightTree {
+
+public:
+    void build(const std::shared_ptr<Scene>& scenePtr);
+    void clear();
+
+    /// Picks a light for 'position', in world space, with 'u' in [0,1). 'lightIndex' is numbered as for
+    /// RayTracer::incidentLight, the directional lights coming first. Returns false without any light.
+    bool sample(const glm::vec3& position, float u, size_t& lightIndex, float& pdf) const;
+
+    /// Intensity of a light at 'position', times its strongest color channel.
+    static float estimate(const LightSourcePoint& light, const glm::vec3& position);
+    static float estimate(const LightSourceDir& light);
+
+    inline bool empty() const { return m_nodes.empty() && m_directionalCDF.empty(); }
+
+private:
+    uint32_t build(std::vector<uint32_t>& lights, uint32_t begin, uint32_t end, const std::vector<glm::vec3>& positions, const std::vector<float>& powers, const std::vector<glm::vec3>& attenuations);
+    float importance(const LightTreeNode& node, const glm::vec3& position) const;
+
+    std::vector<LightTreeNode> m_nodes;
+    std::vector<float> m_directionalCDF; // Running sum of the powers of the directional lights
+    size_t m_numOfLightSourcesDir = 0;
+};
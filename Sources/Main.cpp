@@ -37,6 +37,8 @@ namespace fs = std::filesystem;
 #include "Image.h"
 #include "Rasterizer.h"
 #include "RayTracer.h"
+#include "Integrator/DirectIntegrator.h"
+#include "Integrator/PathIntegrator.h"
 
 using namespace std;
 
@@ -62,6 +64,7 @@ static std::string meshFilename;
 
 // Raytraced rendering
 static bool isDisplayRaytracing (false);
+static bool isProgressive (false); // Ray traced view refined a little at every frame
 
 // Diagnostic
 static int diagnostic = 1;
@@ -87,9 +90,22 @@ void printHelp () {
    			  + "\t* G: increase field of view\n"
    			  + "\t* TAB: switch between rasterization and ray tracing display\n"
    			  + "\t* SPACE: execute ray tracing\n"
+   			  + "\t* V: enable/disable the progressive ray traced view, refined at every frame and restarted whenever the camera moves\n"
 		      + "\t* A: enable/disable acceleration ray tracing with BVH\n"
+		      + "\t* B: cycle the BVH builder: SAH, median, LBVH with 30 and 63 bit Morton codes, SBVH (rebuilds the BVH)\n"
+		      + "\t* L: cycle the layout of the per mesh BVHs: pointer tree, linear array, BVH4, BVH8 (rebuilds the BVH)\n"
+		      + "\t* K: enable/disable tracing the camera rays by packets of 4x4 pixels\n"
 		      + "\t* O: enable/disable occlusion in ray tracing\n"
+		      + "\t* C: enable/disable skipping the point lights too far to light a point\n"
+		      + "\t* I: enable/disable shading one light per sample, picked at random by the light tree\n"
 		      + "\t* P: enable/disable anti-aliasing in ray tracing\n"
+		      + "\t* S: cycle the anti-aliasing sampler (random, stratified, Sobol, R2)\n"
+		      + "\t* W: enable/disable the wavefront ray tracer, which prints the time of each stage\n"
+		      + "\t* Y: enable/disable sorting the shadow rays by direction and origin before tracing them, with the wavefront ray tracer\n"
+		      + "\t* J: benchmark the shadow rays of the wavefront ray tracer without and with sorting them\n"
+		      + "\t* X: switch between direct lighting and path tracing (global illumination, with the BVH)\n"
+		      + "\t* N: enable/disable adaptive sampling, each pixel taking samples until its noise is low enough\n"
+		      + "\t* M: save the last ray traced image and, after adaptive sampling, the samples per pixel heatmap (PPM)\n"
 		      + "\n"
 		      + "\n Diagnostic and SSR:\n"
 		      + "\t* F1: render (SSR: also reset booleans togglers) \n"
@@ -119,6 +135,7 @@ void raytrace () {
 /// Executed each time a key is entered.
 void keyCallback (GLFWwindow * windowPtr, int key, int scancode, int action, int mods) {
 	if (action == GLFW_PRESS) {
+		rayTracerPtr->resetProgressive (); // Any setting may have changed
 		if (key == GLFW_KEY_H) {
 			printHelp ();
 		} else if (action == GLFW_PRESS && key == GLFW_KEY_ESCAPE) {
@@ -129,11 +146,55 @@ void keyCallback (GLFWwindow * windowPtr, int key, int scancode, int action, int
 			scenePtr->camera()->setFoV (std::max (5.f, scenePtr->camera()->getFoV () - 5.f));
 		} else if (action == GLFW_PRESS && key == GLFW_KEY_Q) { // A on a french keyboard
 			rayTracerPtr->useBVH =!(rayTracerPtr->useBVH);
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_B) {
+			if (rayTracerPtr->bvhSplitMethod == BVHSplitMethod::SAH) rayTracerPtr->bvhSplitMethod = BVHSplitMethod::Median;
+			else if (rayTracerPtr->bvhSplitMethod == BVHSplitMethod::Median) {
+				rayTracerPtr->bvhSplitMethod = BVHSplitMethod::LBVH;
+				rayTracerPtr->bvhMortonPrecision = BVHMortonPrecision::Bits30;
+			}
+			else if (rayTracerPtr->bvhSplitMethod == BVHSplitMethod::LBVH && rayTracerPtr->bvhMortonPrecision == BVHMortonPrecision::Bits30) rayTracerPtr->bvhMortonPrecision = BVHMortonPrecision::Bits63;
+			else if (rayTracerPtr->bvhSplitMethod == BVHSplitMethod::LBVH) rayTracerPtr->bvhSplitMethod = BVHSplitMethod::SBVH;
+			else rayTracerPtr->bvhSplitMethod = BVHSplitMethod::SAH;
+			rayTracerPtr->init (scenePtr);
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_L) {
+			if (rayTracerPtr->bvhLayout == BVHLayout::Tree) rayTracerPtr->bvhLayout = BVHLayout::Linear;
+			else if (rayTracerPtr->bvhLayout == BVHLayout::Linear) rayTracerPtr->bvhLayout = BVHLayout::Wide4;
+			else if (rayTracerPtr->bvhLayout == BVHLayout::Wide4) rayTracerPtr->bvhLayout = BVHLayout::Wide8;
+			else rayTracerPtr->bvhLayout = BVHLayout::Tree;
+			rayTracerPtr->init (scenePtr);
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_K) {
+			rayTracerPtr->usePackets = !(rayTracerPtr->usePackets);
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_C) {
+			rayTracerPtr->useLightCulling = !(rayTracerPtr->useLightCulling);
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_I) {
+			rayTracerPtr->useLightSampling = !(rayTracerPtr->useLightSampling);
 		} else if (action == GLFW_PRESS && key == GLFW_KEY_O) { // O on a french keyboard
 			rayTracerPtr->useOcclusion =!(rayTracerPtr->useOcclusion);
 		} else if (action == GLFW_PRESS && key == GLFW_KEY_P) { // P on a french keyboard
 			if (rayTracerPtr->alias_number > 1) rayTracerPtr->alias_number = 1;
 			else rayTracerPtr->alias_number = 3;
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_S) {
+			if (rayTracerPtr->samplerType == SamplerType::Random) rayTracerPtr->samplerType = SamplerType::Stratified;
+			else if (rayTracerPtr->samplerType == SamplerType::Stratified) rayTracerPtr->samplerType = SamplerType::Sobol;
+			else if (rayTracerPtr->samplerType == SamplerType::Sobol) rayTracerPtr->samplerType = SamplerType::R2;
+			else rayTracerPtr->samplerType = SamplerType::Random;
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_W) {
+			rayTracerPtr->useWavefront = !(rayTracerPtr->useWavefront);
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_Y) {
+			rayTracerPtr->sortSecondaryRays = !(rayTracerPtr->sortSecondaryRays);
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_J) {
+			int width, height;
+			glfwGetWindowSize(windowPtr, &width, &height);
+			rayTracerPtr->setResolution (width, height);
+			rayTracerPtr->benchmarkRaySorting (scenePtr);
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_X) {
+			if (rayTracerPtr->integratorPtr->tracesSecondaryRays ()) rayTracerPtr->integratorPtr = std::make_shared<DirectIntegrator> ();
+			else rayTracerPtr->integratorPtr = std::make_shared<PathIntegrator> ();
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_N) {
+			rayTracerPtr->useAdaptiveSampling = !(rayTracerPtr->useAdaptiveSampling);
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_M) {
+			rayTracerPtr->image()->savePPM ("raytraced.ppm");
+			if (rayTracerPtr->sampleHeatmap()) rayTracerPtr->sampleHeatmap()->savePPM ("sampleHeatmap.ppm");
 		} else if (action == GLFW_PRESS && key == GLFW_KEY_G) {
 			scenePtr->camera()->setFoV (std::min (120.f, scenePtr->camera()->getFoV () + 5.f));
 		} else if (action == GLFW_PRESS && key == GLFW_KEY_TAB) {
@@ -141,6 +202,11 @@ void keyCallback (GLFWwindow * windowPtr, int key, int scancode, int action, int
 			//if(isDisplayRaytracing) rayTracerPtr->render (scenePtr);
 		} else if (action == GLFW_PRESS && key == GLFW_KEY_SPACE) {
 			raytrace ();
+		} else if (action == GLFW_PRESS && key == GLFW_KEY_V) {
+			isProgressive = !isProgressive;
+			int width, height;
+			glfwGetWindowSize(windowPtr, &width, &height);
+			rayTracerPtr->setResolution (width, height);
 		} else if (action == GLFW_PRESS && key == GLFW_KEY_F1) {
 			diagnostic = 1;
 			rasterizerPtr->useReflectedShading = true;
@@ -378,7 +444,10 @@ void clear () {
 
 // The main rendering call
 void render () {
-	if (isDisplayRaytracing)
+	if (isProgressive) {
+		rayTracerPtr->renderProgressive (scenePtr);
+		rasterizerPtr->display (rayTracerPtr->image ());
+	} else if (isDisplayRaytracing)
 		//rasterizerPtr->display (rayTracerPtr->image ());
 		rasterizerPtr->renderSSR (scenePtr, diagnostic);
 	else
@@ -402,6 +471,7 @@ void update (float currentTime) {
 		fpsTime = currentTime;
 	}
 	std::string titleWithFPS = BASE_WINDOW_TITLE + " - " + std::to_string (FPS) + "FPS";
+	if (isProgressive) titleWithFPS += " - " + std::to_string (rayTracerPtr->progressiveSamples ()) + " samples";
 	glfwSetWindowTitle (windowPtr, titleWithFPS.c_str ());
 	lastTime = currentTime;
 	frameCount++;
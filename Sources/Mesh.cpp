@@ -61,6 +61,7 @@ void Mesh::clear () {
 	m_vertexTexCoords.clear ();
 	m_vertexNormals.clear ();
 	m_triangleIndices.clear ();
+	m_filename.clear ();
 }
 
 
@@ -11,6 +11,7 @@
 #include <vector>
 #include <memory>
 #include <iostream>
+#include <string>
 
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -30,6 +31,9 @@ public:
 	inline std::vector<glm::vec2> & vertexTexCoords () { return m_vertexTexCoords; } 
 	inline const std::vector<glm::uvec3> & triangleIndices () const { return m_triangleIndices; }
 	inline std::vector<glm::uvec3> & triangleIndices () { return m_triangleIndices; }
+	/// File the mesh was loaded from, empty for a mesh built in code.
+	inline const std::string & filename () const { return m_filename; }
+	inline void setFilename (const std::string & filename) { m_filename = filename; }
 
 	/// Compute the parameters of a sphere which bounds the mesh
 	void computeBoundingSphere (glm::vec3 & center, float & radius) const;
@@ -47,4 +51,5 @@ private:
 	std::vector<glm::vec3> m_vertexNormals;
 	std::vector<glm::vec2> m_vertexTexCoords;
 	std::vector<glm::uvec3> m_triangleIndices;
+	std::string m_filename;
 };
@@ -49,5 +49,6 @@ void MeshLoader::loadOFF (const std::string & filename, std::shared_ptr<Mesh> me
     in.close ();
     meshPtr->vertexNormals ().resize (P.size (), glm::vec3 (0.f, 0.f, 1.f));
     meshPtr->recomputePerVertexNormals ();
+    meshPtr->setFilename (filename);
     Console::print ("Mesh <" + filename + "> loaded");
 }
\ No newline at end of file
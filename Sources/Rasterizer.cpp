@@ -8,8 +8,11 @@
 // ----------------------------------------------
 #include "Rasterizer.h"
 #include <glad/glad.h>
+#include <algorithm>
+#include <numeric>
 #include "Resources.h"
 #include "Error.h"
+#include "Light/LightTree.h"
 
 void Rasterizer::init (const std::string & basePath, const std::shared_ptr<Scene> scenePtr) {
 	glEnable (GL_DEBUG_OUTPUT); // Modern error callback functionnality
@@ -119,9 +122,14 @@ void Rasterizer::initDisplayedImage () {
 
 void Rasterizer::setLights(std::shared_ptr<ShaderProgram> shader, const std::shared_ptr<Scene> scenePtr) {
 	// Light Source - DIRECTIONNAL
-	size_t numOfLightSourcesDir = scenePtr->numOfLightSourcesDir();
+	std::vector<size_t> lights (scenePtr->numOfLightSourcesDir());
+	std::iota (lights.begin(), lights.end(), 0);
+	size_t numOfLightSourcesDir = std::min (lights.size(), RASTERIZER_MAX_LIGHTS);
+	std::partial_sort (lights.begin(), lights.begin() + numOfLightSourcesDir, lights.end(), [&](size_t a, size_t b) {
+		return LightTree::estimate (*scenePtr->lightSourceDir(a)) > LightTree::estimate (*scenePtr->lightSourceDir(b));
+	});
 	for(size_t i=0; i<numOfLightSourcesDir; i++) {
-		auto lightSourcePtr = scenePtr->lightSourceDir(i);
+		auto lightSourcePtr = scenePtr->lightSourceDir(lights[i]);
 		shader->set ("lightsourcesDir[" + std::to_string(i) + "].direction", lightSourcePtr->direction);
 		shader->set ("lightsourcesDir[" + std::to_string(i) + "].intensity", lightSourcePtr->intensity);
 		shader->set ("lightsourcesDir[" + std::to_string(i) + "].color", lightSourcePtr->color);
@@ -130,9 +138,15 @@ void Rasterizer::setLights(std::shared_ptr<ShaderProgram> shader, const std::sha
 
 
 	// Light Source - PONCTUAL
-	size_t numOfLightSourcesPoint = scenePtr->numOflightSourcesPoint();
+	glm::vec3 cameraPosition = glm::vec3 (glm::inverse (scenePtr->camera()->computeViewMatrix ()) * glm::vec4 (0.0f, 0.0f, 0.0f, 1.0f));
+	lights.resize (scenePtr->numOflightSourcesPoint());
+	std::iota (lights.begin(), lights.end(), 0);
+	size_t numOfLightSourcesPoint = std::min (lights.size(), RASTERIZER_MAX_LIGHTS);
+	std::partial_sort (lights.begin(), lights.begin() + numOfLightSourcesPoint, lights.end(), [&](size_t a, size_t b) {
+		return LightTree::estimate (*scenePtr->lightSourcePoint(a), cameraPosition) > LightTree::estimate (*scenePtr->lightSourcePoint(b), cameraPosition);
+	});
 	for(size_t i=0; i<numOfLightSourcesPoint; i++) {
-		auto lightSourcePtr = scenePtr->lightSourcePoint(i);
+		auto lightSourcePtr = scenePtr->lightSourcePoint(lights[i]);
 		shader->set ("lightsourcesPoint[" + std::to_string(i) + "].position", lightSourcePtr->position);
 		shader->set ("lightsourcesPoint[" + std::to_string(i) + "].intensity", lightSourcePtr->intensity);
 		shader->set ("lightsourcesPoint[" + std::to_string(i) + "].color", lightSourcePtr->color);
@@ -164,12 +178,13 @@ void Rasterizer::render (std::shared_ptr<Scene> scenePtr, int diagnostic) {
 
 	setLights(m_pbrShaderProgramPtr, scenePtr);
 
-	// Meshes
-	size_t numOfMeshes = scenePtr->numOfMeshes ();
-	for (size_t i = 0; i < numOfMeshes; i++) {
+	// Meshes, once per instance
+	size_t numOfInstances = scenePtr->numOfInstances ();
+	for (size_t j = 0; j < numOfInstances; j++) {
+		size_t i = scenePtr->instance (j).mesh_index;
 		glm::mat4 projectionMatrix = scenePtr->camera()->computeProjectionMatrix ();
 		m_pbrShaderProgramPtr->set ("projectionMat", projectionMatrix); // Compute the projection matrix of the camera and pass it to the GPU program
-		glm::mat4 modelMatrix = scenePtr->mesh (i)->computeTransformMatrix ();
+		glm::mat4 modelMatrix = scenePtr->instance (j).transform->computeTransformMatrix ();
 		glm::mat4 viewMatrix = scenePtr->camera()->computeViewMatrix ();
 		m_pbrShaderProgramPtr->set ("viewMat", viewMatrix);
 		glm::mat4 modelViewMatrix = viewMatrix * modelMatrix;
@@ -203,10 +218,11 @@ void Rasterizer::renderSSR (std::shared_ptr<Scene> scenePtr, int diagnostic) {
 		glm::mat4 viewMatrix = scenePtr->camera()->computeViewMatrix ();
 		shaderFirstPass->set ("viewMat", viewMatrix);
 
-        // Meshes
-        size_t numOfMeshes = scenePtr->numOfMeshes ();
-        for (size_t i = 0; i < numOfMeshes; i++) {
-            glm::mat4 modelMatrix = scenePtr->mesh (i)->computeTransformMatrix ();
+        // Meshes, once per instance
+        size_t numOfInstances = scenePtr->numOfInstances ();
+        for (size_t j = 0; j < numOfInstances; j++) {
+            size_t i = scenePtr->instance (j).mesh_index;
+            glm::mat4 modelMatrix = scenePtr->instance (j).transform->computeTransformMatrix ();
             glm::mat4 modelViewMatrix = viewMatrix * modelMatrix;
             glm::mat4 normalMatrix = glm::transpose (glm::inverse (modelViewMatrix));
             glm::mat4 invView = glm::inverse (viewMatrix);
@@ -16,6 +16,8 @@
 #include "Image.h"
 #include "ShaderProgram.h"
 
+static const size_t RASTERIZER_MAX_LIGHTS (8); // Of each kind, the size of the light arrays of the shaders
+
 class Rasterizer {
 public:
 
@@ -36,6 +38,7 @@ public:
 	void clear ();
 
 	// Send uniforms
+	/// Beyond RASTERIZER_MAX_LIGHTS lights of a kind, only the brightest ones at the camera are sent.
 	void setLights(std::shared_ptr<ShaderProgram> shader, const std::shared_ptr<Scene> scenePtr);
 	void setMaterial(std::shared_ptr<ShaderProgram> shader, const std::shared_ptr<Scene> scenePtr, size_t mesh_index);
 
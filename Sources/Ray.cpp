@@ -53,7 +53,7 @@ bool Ray::intersect(RayHit& rayHit, const glm::vec3& p0, const glm::vec3& p1, co
 }
 
 
-bool Ray::fastIntersect(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) const {
+bool Ray::fastIntersect(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, float tmin, float tmax) const {
 	float epsilon = 0.0000000001f;
 
 	glm::vec3 e0 = p1 - p0;
@@ -77,6 +77,6 @@ bool Ray::fastIntersect(const glm::vec3& p0, const glm::vec3& p1, const glm::vec
 
 	float t = glm::dot(e1, r);
 
-	if (t >= 0) return true;
+	if ((t >= tmin) && (t < tmax)) return true;
 	return false;
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #define GLM_ENABLE_EXPERIMENTAL
 
 #include <glm/gtx/string_cast.hpp>
+#include <limits>
 
 #include "RayHit.h"
 
@@ -21,9 +22,18 @@ public:
 	glm::vec3& getDirection() { return direction; };
 
 	bool intersect(RayHit& rayHit, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) const;
-	bool fastIntersect(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) const;
+	/// Any hit at a distance in [tmin, tmax).
+	bool fastIntersect(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, float tmin = 0.0f, float tmax = std::numeric_limits<float>::max()) const;
 
 	glm::vec3 origin;
 	glm::vec3 direction;
 	glm::vec3 inv_dir;
 };
+
+/// Segment of a ray for an occlusion query, 'occluded' receiving the answer.
+struct ShadowRay {
+	Ray ray;
+	float tmin;
+	float tmax;
+	bool occluded;
+};
@@ -7,10 +7,12 @@
 #define GLM_ENABLE_EXPERIMENTAL
 
 #include <glm/gtx/string_cast.hpp>
+#include <limits>
 
 
 class RayHit {
 public:
+	RayHit() : RayHit(0, 0, 0, std::numeric_limits<float>::max()) {};
 	RayHit(float b0_, float b1_, float b2_, float t_) : b0(b0_), b1(b1_), b2(b2_), t(t_) {};
     inline glm::vec3 hitPosition(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) { return b0*p0 + b1*p1 + b2*p2; };
 
@@ -8,13 +8,18 @@
 // ----------------------------------------------
 #include "RayTracer.h"
 
+#include <omp.h>
+
 #include "Console.h"
+#include "BRDF.h"
 #include "Camera.h"
+#include "Integrator/DirectIntegrator.h"
 
-#define PI 3.1415f
+static_assert(SHADOW_RAY_BATCH_SIZE <= BRDF_BATCH_SIZE, "directLighting evaluates the BRDF of a batch of shadow rays at once");
 
 
 RayTracer::RayTracer() : 
+	integratorPtr (std::make_shared<DirectIntegrator>()),
 	m_imagePtr (std::make_shared<Image>()) {}
 
 RayTracer::~RayTracer() {
@@ -22,130 +27,735 @@ RayTracer::~RayTracer() {
 
 void RayTracer::init (const std::shared_ptr<Scene> scenePtr) {
 	std::cout << "BVH initiation...";
-	//bvh.init(scenePtr);
+	std::chrono::high_resolution_clock clock;
+	std::chrono::time_point<std::chrono::high_resolution_clock> before = clock.now();
+	tlas.init(scenePtr, bvhLayout, bvhSplitMethod, bvhMortonPrecision, bvhMaxLeafSize, useBVHCache);
+	std::chrono::time_point<std::chrono::high_resolution_clock> after = clock.now();
 	std::cout << " done" << std::endl;
+	double elapsedTime = (double)std::chrono::duration_cast<std::chrono::milliseconds>(after - before).count();
+	std::string splitName = "median";
+	if (bvhSplitMethod == BVHSplitMethod::SAH) splitName = "SAH";
+	else if (bvhSplitMethod == BVHSplitMethod::SBVH) splitName = "SBVH";
+	else if (bvhSplitMethod == BVHSplitMethod::LBVH) splitName = (bvhMortonPrecision == BVHMortonPrecision::Bits63) ? "LBVH 63 bits" : "LBVH 30 bits";
+	std::string layoutName = "tree";
+	if (bvhLayout == BVHLayout::Linear) layoutName = "linear";
+	else if (bvhLayout == BVHLayout::Wide4) layoutName = "BVH4";
+	else if (bvhLayout == BVHLayout::Wide8) layoutName = "BVH8";
+	Console::print ("BVH (" + splitName + " split, " + layoutName + " layout) ready in " + std::to_string (elapsedTime) + "ms on " + std::to_string (omp_get_max_threads()) + " threads: "
+		+ std::to_string (tlas.numOfBLAS ()) + " meshes (" + std::to_string (tlas.numOfCachedBLAS ()) + " from cache), " + std::to_string (tlas.numOfInstances ()) + " instances, " + std::to_string (tlas.numOfNodes ()) + " nodes, "
+		+ std::to_string (tlas.memoryUsage () / 1024) + "KB, SAH cost " + std::to_string (tlas.computeSAHCost ()));
+}
+
+void RayTracer::refit (const std::shared_ptr<Scene> scenePtr, size_t meshIndex) {
+	if (tlas.numOfBLAS () != scenePtr->numOfMeshes ()) {
+		init (scenePtr);
+		return;
+	}
+	std::chrono::high_resolution_clock clock;
+	std::chrono::time_point<std::chrono::high_resolution_clock> before = clock.now();
+	bool rebuilt = tlas.refit(scenePtr, meshIndex, bvhMaxDegradation);
+	std::chrono::time_point<std::chrono::high_resolution_clock> after = clock.now();
+	double elapsedTime = (double)std::chrono::duration_cast<std::chrono::microseconds>(after - before).count() / 1000.0;
+	Console::print ("BVH of mesh " + std::to_string (meshIndex) + (rebuilt ? " rebuilt" : " refitted") + " in " + std::to_string (elapsedTime) + "ms, SAH cost " + std::to_string (tlas.computeSAHCost (meshIndex)));
+}
+
+bool RayTracer::intersect (const std::shared_ptr<Scene>& scenePtr, RayHit& rayHit, const Ray& ray, size_t& instance_index, size_t& triangle_index) const {
+	return tlas.intersect(scenePtr, rayHit, ray, instance_index, triangle_index);
+}
+
+bool RayTracer::fastIntersect (const std::shared_ptr<Scene>& scenePtr, const Ray& ray, float tmin, float tmax) const {
+	return tlas.fastIntersect(scenePtr, ray, tmin, tmax);
+}
+
+void RayTracer::fastIntersect (const std::shared_ptr<Scene>& scenePtr, ShadowRay* shadowRays, size_t count) const {
+	tlas.fastIntersect(scenePtr, shadowRays, count);
+}
+
+void RayTracer::prepareFrame (const std::shared_ptr<Scene>& scenePtr, bool withBVH, std::vector<glm::mat4>& modelViewMats, std::vector<glm::mat4>& normalMats) {
+	glm::mat4 viewMat = scenePtr->camera()->computeViewMatrix ();
+	scenePtr->camera()->computeVectorsForRayAt(m_viewRight, m_viewUp, m_viewDir, m_eye, m_w);
+	modelViewMats.clear();
+	normalMats.clear();
+    if(withBVH) {
+		// The instances may have moved since the last frame, only the top level is updated for that
+		if (tlas.numOfBLAS () != scenePtr->numOfMeshes ()) init (scenePtr);
+		else tlas.update (scenePtr);
+	
+		for (size_t i = 0; i < scenePtr->numOfInstances (); i++) {
+			glm::mat4 modelMat = tlas.instance(i).objectToWorld;
+			glm::mat4 modelViewMat = viewMat * modelMat;
+			glm::mat4 normalMat = glm::transpose (glm::inverse (modelViewMat));
+
+			modelViewMats.push_back(modelViewMat);
+			normalMats.push_back(normalMat);
+		}
+	}
+	m_modelViewMats = modelViewMats;
+	m_normalMats = normalMats;
+	m_viewToWorld = glm::inverse (viewMat);
+
+	// The point lights may have moved since the last frame, they are few enough to rebuild their hierarchies
+	m_lightBVH.build(scenePtr, useLightCulling ? POINT_LIGHT_CUTOFF : 0.0f);
+	if(useLightSampling) m_lightTree.build(scenePtr);
+	else m_lightTree.clear();
+	m_lightSampler = Sampler (SamplerType::Random, (uint32_t)(alias_number*alias_number));
+	m_pointLightViewPositions.resize(scenePtr->numOflightSourcesPoint());
+	for (size_t i = 0; i < m_pointLightViewPositions.size(); i++)
+		m_pointLightViewPositions[i] = glm::vec3(viewMat * glm::vec4(scenePtr->lightSourcePoint(i)->position, 1.0f));
 }
 
 void RayTracer::render (const std::shared_ptr<Scene> scenePtr) {
 	size_t width = m_imagePtr->width();
 	size_t height = m_imagePtr->height();
 	std::chrono::high_resolution_clock clock;
-	Console::print ("Start ray tracing at " + std::to_string (width) + "x" + std::to_string (height) + " resolution...");
+	Console::print ("Start ray tracing at " + std::to_string (width) + "x" + std::to_string (height) + " resolution on " + std::to_string ((numOfThreads > 0) ? numOfThreads : omp_get_max_threads()) + " threads...");
 	std::chrono::time_point<std::chrono::high_resolution_clock> before = clock.now();
 	//m_imagePtr->clear (scenePtr->backgroundColor ());
 	//m_imagePtr->operator()(10, 10) = glm::vec3(1.0, 0.0, 0.0);
 	
 	// <---- Ray tracing code ---->
-	size_t numOfMeshes = scenePtr->numOfMeshes ();
-	glm::vec3 camPos = scenePtr->camera()->getPosition();
+	size_t numOfInstances = scenePtr->numOfInstances ();
 	
-	RayHit rayHit = RayHit(0, 0, 0, 0);
-	Ray ray;
-
 	// Precomputation
 	glm::vec3 viewRight,  viewUp,  viewDir,  eye;
     float w;
 	std::vector<glm::mat4> modelViewMats;
 	std::vector<glm::mat4> normalMats;
-    if(useBVH) {
-		scenePtr->camera()->computeVectorsForRayAt(viewRight, viewUp, viewDir, eye, w);
-	
-		for (size_t i = 0; i < numOfMeshes; i++) {
-			const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(i);
-			glm::mat4 modelMat = mesh->computeTransformMatrix ();
-			glm::mat4 viewMat = scenePtr->camera()->computeViewMatrix ();
-			glm::mat4 modelViewMat = viewMat * modelMat;
-			glm::mat4 normalMat = glm::transpose (glm::inverse (modelViewMat));
-
-			modelViewMats.push_back(modelViewMat);
-			normalMats.push_back(normalMat);
-		}
-	}
+	prepareFrame(scenePtr, useBVH, modelViewMats, normalMats);
+	scenePtr->camera()->computeVectorsForRayAt(viewRight, viewUp, viewDir, eye, w);
+	integratorPtr->resetStatistics();
 
-	float posX, posY;
-	float shiftedX, shiftedY;
-	float rx, ry;
-	glm::vec3 color;
 	glm::vec3 backgroundColor = scenePtr->backgroundColor ();
 
-	for(size_t x=0; x<width; x++) {
-		for(size_t y=0; y<height; y++) {
-			color = glm::vec3(0.0f, 0.0f, 0.0f);
-
-			for(size_t kx=0; kx<alias_number; kx++) {
-				for(size_t ky=0; ky<alias_number; ky++) {
-					if(alias_number > 1) { // Use anti-aliasing
-						rx = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-						ry = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-						shiftedX = x + (kx + rx) /(float)(alias_number) - 0.5f;
-						shiftedY = y + (ky + ry) /(float)(alias_number) - 0.5f;
-					}
-					else { // No anti-aliasing
-						shiftedX = x;
-						shiftedY = y;
-					}
-					posX = shiftedX / (float)(width  - 1);
-					posY = 1 - (shiftedY / (float)(height - 1));
-
-					rayHit.t = std::numeric_limits<float>::max();
-
-					if (useBVH) {
-						ray = scenePtr->camera()->rayAt(posX, posY, viewRight, viewUp, viewDir, eye, w);
-						size_t mesh_index = 0;
-						size_t triangle_index = 0;
-						bool hit = bvh.intersect(scenePtr, rayHit, ray, mesh_index, triangle_index);
-						if(hit) color += shade(scenePtr, rayHit, mesh_index, triangle_index, modelViewMats[mesh_index], normalMats[mesh_index]);
-						else 	color += backgroundColor;
+	if (useBVH && useAdaptiveSampling) {
+		renderAdaptive(scenePtr, modelViewMats, normalMats);
+	}
+	else if (useBVH && useWavefront && !integratorPtr->tracesSecondaryRays()) {
+		renderWavefront(scenePtr, modelViewMats, normalMats);
+	}
+	else {
+		// The screen is cut in tiles which are handed to the threads one at a time,
+		// so that the cost of a tile (background or detailed geometry) does not matter
+		size_t numOfTilesX = (width  + tileSize - 1) / tileSize;
+		size_t numOfTilesY = (height + tileSize - 1) / tileSize;
+		int numOfTiles = (int)(numOfTilesX * numOfTilesY);
+		int threads = (numOfThreads > 0) ? numOfThreads : omp_get_max_threads();
+		Sampler sampler (samplerType, (uint32_t)(alias_number*alias_number));
+
+		#pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+		for(int tile=0; tile<numOfTiles; tile++) {
+			size_t startX = (tile % numOfTilesX) * tileSize;
+			size_t startY = (tile / numOfTilesX) * tileSize;
+			size_t endX = std::min(width,  startX + tileSize);
+			size_t endY = std::min(height, startY + tileSize);
+
+			RayHit rayHit = RayHit(0, 0, 0, 0);
+			Ray ray;
+			glm::vec2 position;
+			glm::vec3 color;
+
+			if (useBVH && usePackets) {
+				// The camera rays of a square of pixels are traced together, one sample at a time
+				glm::vec3 colors[RAY_PACKET_SIZE];
+				for(size_t blockY=startY; blockY<endY; blockY+=RAY_PACKET_WIDTH) {
+					for(size_t blockX=startX; blockX<endX; blockX+=RAY_PACKET_WIDTH) {
+						size_t blockEndX = std::min(endX, blockX + RAY_PACKET_WIDTH);
+						size_t blockEndY = std::min(endY, blockY + RAY_PACKET_WIDTH);
+						std::fill(colors, colors + RAY_PACKET_SIZE, glm::vec3(0.0f, 0.0f, 0.0f));
+						for(size_t sample=0; sample<(size_t)(alias_number*alias_number); sample++)
+							traceBlock(scenePtr, sampler, blockX, blockY, blockEndX, blockEndY, (uint32_t)sample, modelViewMats, normalMats, colors);
+
+						size_t i = 0;
+						for(size_t y=blockY; y<blockEndY; y++) {
+							for(size_t x=blockX; x<blockEndX; x++)
+								m_imagePtr->operator()(x,y) = colors[i++] / (float)(alias_number*alias_number);
+						}
 					}
-					else {
-						ray = scenePtr->camera()->rayAt(posX, posY);
-						for (size_t i = 0; i < numOfMeshes; i++) {
-							const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(i);
-
-							const std::vector<glm::vec3>& vertexPositions  = mesh->vertexPositions();
-							const std::vector<glm::uvec3>& triangleIndices = mesh->triangleIndices();
-							const size_t nbTriangles = triangleIndices.size();
-
-							for(size_t k=0; k<nbTriangles; k++) {
-								const glm::uvec3& trianglePos = triangleIndices[k];
-								const glm::vec3& p0 = vertexPositions[trianglePos[0]];
-								const glm::vec3& p1 = vertexPositions[trianglePos[1]];
-								const glm::vec3& p2 = vertexPositions[trianglePos[2]];
-								
-								bool hit = ray.intersect(rayHit, p0, p1, p2);
-								if(hit) color += shade(scenePtr, rayHit, i, k);
+				}
+				continue;
+			}
+
+			// Row major, as in the image
+			for(size_t y=startY; y<endY; y++) {
+				for(size_t x=startX; x<endX; x++) {
+					color = glm::vec3(0.0f, 0.0f, 0.0f);
+
+					for(size_t kx=0; kx<alias_number; kx++) {
+						for(size_t ky=0; ky<alias_number; ky++) {
+							position = screenPosition(sampler, x, y, (uint32_t)(kx*alias_number + ky));
+
+							rayHit.t = std::numeric_limits<float>::max();
+
+							if (useBVH) {
+								ray = scenePtr->camera()->rayAt(position.x, position.y, viewRight, viewUp, viewDir, eye, w);
+								size_t instance_index = 0;
+								size_t triangle_index = 0;
+								bool hit = intersect(scenePtr, rayHit, ray, instance_index, triangle_index);
+								if(hit) color += shade(scenePtr, rayHit, instance_index, triangle_index, modelViewMats[instance_index], normalMats[instance_index], (uint32_t)(y*width + x), (uint32_t)(kx*alias_number + ky));
 								else 	color += backgroundColor;
 							}
+							else {
+								Ray worldRay = scenePtr->camera()->rayAt(position.x, position.y);
+								for (size_t i = 0; i < numOfInstances; i++) {
+									const MeshInstance& instance = scenePtr->instance(i);
+									const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(instance.mesh_index);
+									glm::mat4 worldToObject = glm::inverse (instance.transform->computeTransformMatrix ());
+									ray = Ray(glm::vec3(worldToObject * glm::vec4(worldRay.origin, 1.0f)), glm::vec3(worldToObject * glm::vec4(worldRay.direction, 0.0f)));
+
+									const std::vector<glm::vec3>& vertexPositions  = mesh->vertexPositions();
+									const std::vector<glm::uvec3>& triangleIndices = mesh->triangleIndices();
+									const size_t nbTriangles = triangleIndices.size();
+
+									for(size_t k=0; k<nbTriangles; k++) {
+										const glm::uvec3& trianglePos = triangleIndices[k];
+										const glm::vec3& p0 = vertexPositions[trianglePos[0]];
+										const glm::vec3& p1 = vertexPositions[trianglePos[1]];
+										const glm::vec3& p2 = vertexPositions[trianglePos[2]];
+									
+										bool hit = ray.intersect(rayHit, p0, p1, p2);
+										if(hit) color += shade(scenePtr, rayHit, i, k, (uint32_t)(y*width + x), (uint32_t)(kx*alias_number + ky));
+										else 	color += backgroundColor;
+									}
+								}
+							}
 						}
 					}
+					m_imagePtr->operator()(x,y) = color / (float)(alias_number*alias_number);
 				}
 			}
-			m_imagePtr->operator()(x,y) = color / (float)(alias_number*alias_number);
 		}
 	}
 
 	std::chrono::time_point<std::chrono::high_resolution_clock> after = clock.now();
 	double elapsedTime = (double)std::chrono::duration_cast<std::chrono::milliseconds>(after - before).count();
 	Console::print ("Ray tracing executed in " + std::to_string(elapsedTime) + "ms");
+	std::string statistics = integratorPtr->statistics();
+	if (!statistics.empty()) Console::print (statistics);
 }
 
 
 
-glm::vec3 RayTracer::shade(const std::shared_ptr<Scene> scenePtr, RayHit& rayHit, size_t& mesh_index, size_t& triangle_index) {
-	const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(mesh_index);
-	glm::mat4 modelMat = mesh->computeTransformMatrix ();
+glm::vec2 RayTracer::screenPosition(const Sampler& sampler, size_t x, size_t y, uint32_t sampleIndex) const {
+	size_t width = m_imagePtr->width();
+	size_t height = m_imagePtr->height();
+	float shiftedX = x;
+	float shiftedY = y;
+	if(sampler.samplesPerPixel() > 1) { // Use anti-aliasing
+		glm::vec2 offset = sampler.get2D((uint32_t)(y*width + x), sampleIndex);
+		shiftedX += offset.x - 0.5f;
+		shiftedY += offset.y - 0.5f;
+	}
+	return glm::vec2(shiftedX / (float)(width  - 1), 1 - (shiftedY / (float)(height - 1)));
+}
+
+void RayTracer::traceBlock(const std::shared_ptr<Scene>& scenePtr, const Sampler& sampler, size_t blockX, size_t blockY, size_t blockEndX, size_t blockEndY, uint32_t sampleIndex,
+						   const std::vector<glm::mat4>& modelViewMats, const std::vector<glm::mat4>& normalMats, glm::vec3* colors, uint32_t activeMask) {
+	const size_t width = m_imagePtr->width();
+	const glm::vec3 backgroundColor = scenePtr->backgroundColor ();
+	RayPacket packet;
+	size_t pixels[RAY_PACKET_SIZE]; // Of the rays in the block
+	size_t pixel = 0;
+	for(size_t y=blockY; y<blockEndY; y++) {
+		for(size_t x=blockX; x<blockEndX; x++, pixel++) {
+			if(!(activeMask & (1u << pixel))) continue;
+			glm::vec2 position = screenPosition(sampler, x, y, sampleIndex);
+			pixels[packet.size] = pixel;
+			packet.rays[packet.size++] = scenePtr->camera()->rayAt(position.x, position.y, m_viewRight, m_viewUp, m_viewDir, m_eye, m_w);
+		}
+	}
+	if(packet.size == 0) return;
+
+	if(usePackets) {
+		packet.init();
+		tlas.intersect(scenePtr, packet);
+	}
+	else {
+		for(size_t i=0; i<packet.size; i++) {
+			packet.rayHits[i] = RayHit();
+			packet.hit[i] = intersect(scenePtr, packet.rayHits[i], packet.rays[i], packet.instance_index[i], packet.triangle_index[i]);
+		}
+	}
+
+	const size_t blockWidth = blockEndX - blockX;
+	for(size_t i=0; i<packet.size; i++) {
+		const size_t x = blockX + pixels[i] % blockWidth;
+		const size_t y = blockY + pixels[i] / blockWidth;
+		const size_t instance_index = packet.instance_index[i];
+		if(packet.hit[i]) colors[pixels[i]] += shade(scenePtr, packet.rayHits[i], packet.instance_index[i], packet.triangle_index[i], modelViewMats[instance_index], normalMats[instance_index], (uint32_t)(y*width + x), sampleIndex);
+		else 			  colors[pixels[i]] += backgroundColor;
+	}
+}
+
+void RayTracer::renderAdaptive(const std::shared_ptr<Scene>& scenePtr, const std::vector<glm::mat4>& modelViewMats, const std::vector<glm::mat4>& normalMats) {
+	size_t width = m_imagePtr->width();
+	size_t height = m_imagePtr->height();
+	size_t numOfTilesX = (width  + tileSize - 1) / tileSize;
+	size_t numOfTilesY = (height + tileSize - 1) / tileSize;
+	int numOfTiles = (int)(numOfTilesX * numOfTilesY);
+	int threads = (numOfThreads > 0) ? numOfThreads : omp_get_max_threads();
+	const size_t minSamples = std::max((size_t)2, adaptiveMinSamples);
+	const size_t maxSamples = std::max(minSamples, adaptiveMaxSamples);
+	// A stratified grid would only be covered by the pixels taking all the samples, the sequences are good at any number
+	Sampler sampler (samplerType == SamplerType::Stratified ? SamplerType::Sobol : samplerType, (uint32_t)maxSamples);
+	std::vector<uint32_t> sampleCounts (width*height);
+
+	#pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+	for(int tile=0; tile<numOfTiles; tile++) {
+		size_t startX = (tile % numOfTilesX) * tileSize;
+		size_t startY = (tile / numOfTilesX) * tileSize;
+		size_t endX = std::min(width,  startX + tileSize);
+		size_t endY = std::min(height, startY + tileSize);
+		for(size_t blockY=startY; blockY<endY; blockY+=RAY_PACKET_WIDTH) {
+			for(size_t blockX=startX; blockX<endX; blockX+=RAY_PACKET_WIDTH) {
+				size_t blockEndX = std::min(endX, blockX + RAY_PACKET_WIDTH);
+				size_t blockEndY = std::min(endY, blockY + RAY_PACKET_WIDTH);
+				const size_t numOfPixels = (blockEndX - blockX) * (blockEndY - blockY);
+
+				// Running mean and variance of the luminance of every pixel (Welford), a pixel leaving the packet once its mean is known well enough
+				glm::vec3 sums[RAY_PACKET_SIZE];
+				glm::vec3 colors[RAY_PACKET_SIZE];
+				float means[RAY_PACKET_SIZE] = {};
+				float m2s[RAY_PACKET_SIZE] = {};
+				uint32_t activeMask = (1u << numOfPixels) - 1;
+				std::fill(sums, sums + RAY_PACKET_SIZE, glm::vec3(0.0f, 0.0f, 0.0f));
+				size_t numOfSamples = 0;
+				while(activeMask != 0 && numOfSamples < maxSamples) {
+					std::fill(colors, colors + RAY_PACKET_SIZE, glm::vec3(0.0f, 0.0f, 0.0f));
+					traceBlock(scenePtr, sampler, blockX, blockY, blockEndX, blockEndY, (uint32_t)numOfSamples, modelViewMats, normalMats, colors, activeMask);
+					numOfSamples++;
+					for(size_t i=0; i<numOfPixels; i++) {
+						if(!(activeMask & (1u << i))) continue;
+						sums[i] += colors[i];
+						float luminance = glm::dot(colors[i], glm::vec3(0.2126f, 0.7152f, 0.0722f));
+						float delta = luminance - means[i];
+						means[i] += delta / (float)numOfSamples;
+						m2s[i] += delta * (luminance - means[i]);
+						float standardError = std::sqrt(m2s[i] / (float)((numOfSamples - 1) * numOfSamples));
+						if(numOfSamples >= minSamples && standardError <= adaptiveThreshold) {
+							activeMask &= ~(1u << i);
+							sampleCounts[(blockY + i / (blockEndX - blockX))*width + blockX + i % (blockEndX - blockX)] = (uint32_t)numOfSamples;
+						}
+					}
+				}
+
+				size_t i = 0;
+				for(size_t y=blockY; y<blockEndY; y++) {
+					for(size_t x=blockX; x<blockEndX; x++, i++) {
+						if(activeMask & (1u << i)) sampleCounts[y*width + x] = (uint32_t)numOfSamples;
+						m_imagePtr->operator()(x,y) = sums[i] / (float)sampleCounts[y*width + x];
+					}
+				}
+			}
+		}
+	}
+
+	// Blue for the fewest samples, then green, yellow and red for the most
+	if (!m_sampleHeatmapPtr || m_sampleHeatmapPtr->width() != width || m_sampleHeatmapPtr->height() != height) m_sampleHeatmapPtr = make_shared<Image> (width, height);
+	size_t totalSamples = 0;
+	for(size_t i=0; i<width*height; i++) {
+		totalSamples += sampleCounts[i];
+		float t = (maxSamples > minSamples) ? (float)(sampleCounts[i] - minSamples) / (float)(maxSamples - minSamples) : 1.0f;
+		if(t < 1.0f / 3.0f) 	 (*m_sampleHeatmapPtr)[i] = glm::mix(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f), 3.0f * t);
+		else if(t < 2.0f / 3.0f) (*m_sampleHeatmapPtr)[i] = glm::mix(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f, 1.0f, 0.0f), 3.0f * t - 1.0f);
+		else 					 (*m_sampleHeatmapPtr)[i] = glm::mix(glm::vec3(1.0f, 1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), 3.0f * t - 2.0f);
+	}
+	Console::print ("Adaptive sampling: " + std::to_string((double)totalSamples / (double)(width*height)) + " samples per pixel on average, "
+		+ std::to_string(100.0 * (double)totalSamples / (double)(width*height*maxSamples)) + "% of the rays of " + std::to_string(maxSamples) + " samples everywhere");
+}
+
+void RayTracer::renderWavefront(const std::shared_ptr<Scene>& scenePtr, const std::vector<glm::mat4>& modelViewMats, const std::vector<glm::mat4>& normalMats) {
+	size_t width = m_imagePtr->width();
+	size_t height = m_imagePtr->height();
+	int threads = (numOfThreads > 0) ? numOfThreads : omp_get_max_threads();
+	const size_t numOfSamples = alias_number*alias_number;
+	const size_t numOfLights = std::max((size_t)1, useLightSampling ? lightSamples : scenePtr->numOfLightSourcesDir() + scenePtr->numOflightSourcesPoint()); // Shadow ray slots per camera ray
+	const size_t numOfMaterials = scenePtr->numOfMaterials();
+	const glm::vec3 backgroundColor = scenePtr->backgroundColor ();
+	Sampler sampler (samplerType, (uint32_t)numOfSamples);
+	glm::vec3 viewRight,  viewUp,  viewDir,  eye;
+	float w;
+	scenePtr->camera()->computeVectorsForRayAt(viewRight, viewUp, viewDir, eye, w);
+
+	// The rays are generated by groups: one sample of a square of RAY_PACKET_WIDTH pixels, the samples of a square following each other.
+	// The rays of a group are coherent and traced as a packet, the slots of the groups overflowing the image are left empty.
+	const size_t numOfSquaresX = (width  + RAY_PACKET_WIDTH - 1) / RAY_PACKET_WIDTH;
+	const size_t numOfSquaresY = (height + RAY_PACKET_WIDTH - 1) / RAY_PACKET_WIDTH;
+	const size_t numOfGroups = numOfSquaresX * numOfSquaresY * numOfSamples;
+	const size_t waveSize = std::max(RAY_PACKET_SIZE, std::min(RAY_WAVEFRONT_SIZE, RAY_WAVEFRONT_SHADOW_RAYS / numOfLights) / RAY_PACKET_SIZE * RAY_PACKET_SIZE);
+	const size_t groupsPerWave = waveSize / RAY_PACKET_SIZE;
+	const uint32_t noPixel = std::numeric_limits<uint32_t>::max();
+	const uint32_t noHit = std::numeric_limits<uint32_t>::max();
+
+	// Buffers of a wave, one slot per camera ray and numOfLights slots per camera ray for the shadow rays
+	std::vector<Ray> rays (waveSize);
+	std::vector<uint32_t> pixels (waveSize);
+	std::vector<RayHit> rayHits (waveSize);
+	std::vector<uint32_t> instanceIndices (waveSize);
+	std::vector<uint32_t> triangleIndices (waveSize);
+	std::vector<uint32_t> materialIndices (waveSize); // Sorting key: numOfMaterials for a miss, past it for an empty slot
+	std::vector<uint32_t> order (waveSize);
+	std::vector<uint32_t> materialOffsets (numOfMaterials + 3);
+	std::vector<glm::vec3> colors (waveSize);
+	std::vector<uint32_t> numOfShadowRays (waveSize);
+	std::vector<ShadowRay> shadowRays (waveSize * numOfLights);
+	std::vector<glm::vec3> contributions (waveSize * numOfLights);
+
+	std::vector<uint32_t> shadowRayIndices; // Queued shadow rays, in tracing order when they are sorted
+	shadowRayIndices.reserve (waveSize * numOfLights);
+
+	m_imagePtr->clear ();
+	const char* stageNames[NumOfWavefrontStages] = { "generation", "tracing", "sorting", "shading", "shadow ray sorting", "shadow rays", "accumulation" };
+	double* stageTimes = m_wavefrontStageTimes;
+	std::fill(stageTimes, stageTimes + NumOfWavefrontStages, 0.0);
+	std::chrono::high_resolution_clock clock;
+	std::chrono::time_point<std::chrono::high_resolution_clock> stageStart = clock.now();
+	auto endStage = [&](WavefrontStage stage) {
+		std::chrono::time_point<std::chrono::high_resolution_clock> now = clock.now();
+		stageTimes[stage] += (double)std::chrono::duration_cast<std::chrono::microseconds>(now - stageStart).count() / 1000.0;
+		stageStart = now;
+	};
+
+	for(size_t firstGroup=0; firstGroup<numOfGroups; firstGroup+=groupsPerWave) {
+		const int numOfWaveGroups = (int)std::min(groupsPerWave, numOfGroups - firstGroup);
+		const int numOfWaveRays = numOfWaveGroups * (int)RAY_PACKET_SIZE;
+
+		// Camera rays
+		#pragma omp parallel for schedule(static) num_threads(threads)
+		for(int group=0; group<numOfWaveGroups; group++) {
+			size_t square = (firstGroup + group) / numOfSamples;
+			size_t sample = (firstGroup + group) % numOfSamples;
+			size_t startX = (square % numOfSquaresX) * RAY_PACKET_WIDTH;
+			size_t startY = (square / numOfSquaresX) * RAY_PACKET_WIDTH;
+			for(size_t i=0; i<RAY_PACKET_SIZE; i++) {
+				size_t slot = group * RAY_PACKET_SIZE + i;
+				size_t x = startX + i % RAY_PACKET_WIDTH;
+				size_t y = startY + i / RAY_PACKET_WIDTH;
+				if(x >= width || y >= height) {
+					pixels[slot] = noPixel;
+					continue;
+				}
+				glm::vec2 position = screenPosition(sampler, x, y, (uint32_t)sample);
+				rays[slot] = scenePtr->camera()->rayAt(position.x, position.y, viewRight, viewUp, viewDir, eye, w);
+				pixels[slot] = (uint32_t)(y*width + x);
+			}
+		}
+		endStage(Generation);
+
+		// Closest hits
+		#pragma omp parallel for schedule(dynamic, 16) num_threads(threads)
+		for(int group=0; group<numOfWaveGroups; group++) {
+			size_t first = group * RAY_PACKET_SIZE;
+			if(usePackets) {
+				RayPacket packet;
+				size_t slots[RAY_PACKET_SIZE];
+				for(size_t i=first; i<first+RAY_PACKET_SIZE; i++) {
+					if(pixels[i] == noPixel) continue;
+					slots[packet.size] = i;
+					packet.rays[packet.size++] = rays[i];
+				}
+				packet.init();
+				tlas.intersect(scenePtr, packet);
+				for(size_t i=0; i<packet.size; i++) {
+					rayHits[slots[i]] = packet.rayHits[i];
+					instanceIndices[slots[i]] = packet.hit[i] ? (uint32_t)packet.instance_index[i] : noHit;
+					triangleIndices[slots[i]] = (uint32_t)packet.triangle_index[i];
+				}
+			}
+			else {
+				for(size_t i=first; i<first+RAY_PACKET_SIZE; i++) {
+					if(pixels[i] == noPixel) continue;
+					rayHits[i] = RayHit();
+					size_t instance_index = 0;
+					size_t triangle_index = 0;
+					bool hit = intersect(scenePtr, rayHits[i], rays[i], instance_index, triangle_index);
+					instanceIndices[i] = hit ? (uint32_t)instance_index : noHit;
+					triangleIndices[i] = (uint32_t)triangle_index;
+				}
+			}
+		}
+		endStage(Tracing);
+
+		// Counting sort of the slots by material, so that a material is shaded for many hits in a row
+		std::fill(materialOffsets.begin(), materialOffsets.end(), 0);
+		for(int i=0; i<numOfWaveRays; i++) {
+			uint32_t material = (uint32_t)numOfMaterials + 1;
+			if(pixels[i] != noPixel) material = (instanceIndices[i] == noHit) ? (uint32_t)numOfMaterials : (uint32_t)scenePtr->getMaterialOfMesh(scenePtr->instance(instanceIndices[i]).mesh_index);
+			materialIndices[i] = material;
+			materialOffsets[material + 1]++;
+		}
+		for(size_t m=1; m<materialOffsets.size(); m++) materialOffsets[m] += materialOffsets[m - 1];
+		for(int i=0; i<numOfWaveRays; i++) order[materialOffsets[materialIndices[i]]++] = (uint32_t)i;
+		const int numOfShadedRays = (int)materialOffsets[numOfMaterials]; // Hits and misses, the empty slots are at the end
+		endStage(Sorting);
+
+		// Shading: the lights are gathered and their shadow rays queued. Every thread shades a range of the sorted hits,
+		// evaluating the BRDF by batches of lights of consecutive hits with the same material
+		#pragma omp parallel num_threads(threads)
+		{
+			BRDFBatch batch;
+			const Material* batchMaterial = nullptr;
+			size_t batchContributions[BRDF_BATCH_SIZE]; // Where the reflected light goes
+			glm::vec3 batchLights[BRDF_BATCH_SIZE];
+			auto evaluateBatch = [&]() {
+				if(batch.size == 0) return;
+				BRDF::evaluate(*batchMaterial, batch);
+				for(size_t k=0; k<batch.size; k++) contributions[batchContributions[k]] = batchLights[k] * batch.result(k);
+				batch.clear();
+			};
+			#pragma omp for schedule(static)
+			for(int i=0; i<numOfShadedRays; i++) {
+				const uint32_t slot = order[i];
+				numOfShadowRays[slot] = 0;
+				if(instanceIndices[slot] == noHit) {
+					colors[slot] = backgroundColor;
+					continue;
+				}
+				colors[slot] = glm::vec3(0.0f, 0.0f, 0.0f);
+				const size_t instance_index = instanceIndices[slot];
+				ShadingPoint point = shadingPoint(scenePtr, rayHits[slot], instance_index, triangleIndices[slot], modelViewMats[instance_index], normalMats[instance_index]);
+				if(point.material.get() != batchMaterial) {
+					evaluateBatch();
+					batchMaterial = point.material.get();
+				}
+				ShadowRay* slotShadowRays = shadowRays.data() + slot * numOfLights;
+				const uint32_t sample = (uint32_t)((firstGroup + slot / RAY_PACKET_SIZE) % numOfSamples);
+				uint32_t count = 0;
+				forEachLight(scenePtr, point, pixels[slot], sample, [&](size_t lightIndex, float weight) {
+					glm::vec3 wi;
+					if(!incidentLight(scenePtr, point, lightIndex, normalMats[instance_index], wi, batchLights[batch.size], slotShadowRays[count])) return;
+					batchLights[batch.size] *= weight;
+					batchContributions[batch.size] = slot * numOfLights + count++;
+					batch.push(point.fNormal, point.w0, wi);
+					if(batch.full()) evaluateBatch();
+				});
+				numOfShadowRays[slot] = count;
+			}
+			evaluateBatch();
+
+			// Without the occlusion, all of them arrive
+			if(!useOcclusion) {
+				#pragma omp barrier
+				#pragma omp for schedule(static)
+				for(int i=0; i<numOfShadedRays; i++) {
+					const uint32_t slot = order[i];
+					for(uint32_t l=0; l<numOfShadowRays[slot]; l++) colors[slot] += contributions[slot * numOfLights + l];
+				}
+			}
+		}
+		endStage(Shading);
+
+		// Shadow rays sorted over the whole wave: the ones of neighbor hits towards the same light are traced together
+		if(useOcclusion && sortSecondaryRays) {
+			shadowRayIndices.clear();
+			for(int i=0; i<numOfShadedRays; i++) {
+				const uint32_t slot = order[i];
+				for(uint32_t l=0; l<numOfShadowRays[slot]; l++) shadowRayIndices.push_back((uint32_t)(slot * numOfLights + l));
+			}
+			RaySorter::sort(shadowRays.data(), shadowRayIndices, threads > 1);
+		}
+		endStage(RaySorting);
+
+		if(useOcclusion && sortSecondaryRays) {
+			const int numOfBatches = (int)((shadowRayIndices.size() + SHADOW_RAY_BATCH_SIZE - 1) / SHADOW_RAY_BATCH_SIZE);
+			#pragma omp parallel for schedule(dynamic, 16) num_threads(threads)
+			for(int batch=0; batch<numOfBatches; batch++) {
+				const size_t first = batch * SHADOW_RAY_BATCH_SIZE;
+				const size_t count = std::min(SHADOW_RAY_BATCH_SIZE, shadowRayIndices.size() - first);
+				ShadowRay batchShadowRays[SHADOW_RAY_BATCH_SIZE];
+				for(size_t i=0; i<count; i++) batchShadowRays[i] = shadowRays[shadowRayIndices[first + i]];
+				fastIntersect(scenePtr, batchShadowRays, count);
+				for(size_t i=0; i<count; i++) shadowRays[shadowRayIndices[first + i]].occluded = batchShadowRays[i].occluded;
+			}
+			#pragma omp parallel for schedule(static) num_threads(threads)
+			for(int i=0; i<numOfShadedRays; i++) {
+				const uint32_t slot = order[i];
+				for(uint32_t l=0; l<numOfShadowRays[slot]; l++) {
+					if(!shadowRays[slot * numOfLights + l].occluded) colors[slot] += contributions[slot * numOfLights + l];
+				}
+			}
+		}
+		// Otherwise the ones of a hit as a batch
+		else if(useOcclusion) {
+			#pragma omp parallel for schedule(dynamic, 64) num_threads(threads)
+			for(int i=0; i<numOfShadedRays; i++) {
+				const uint32_t slot = order[i];
+				if(numOfShadowRays[slot] == 0) continue;
+				ShadowRay* slotShadowRays = shadowRays.data() + slot * numOfLights;
+				fastIntersect(scenePtr, slotShadowRays, numOfShadowRays[slot]);
+				for(uint32_t l=0; l<numOfShadowRays[slot]; l++) {
+					if(!slotShadowRays[l].occluded) colors[slot] += contributions[slot * numOfLights + l];
+				}
+			}
+		}
+		endStage(Occlusion);
+
+		// The samples of a square may be in any thread of the previous stages, they are summed square by square
+		const int firstSquare = (int)(firstGroup / numOfSamples);
+		const int lastSquare = (int)((firstGroup + numOfWaveGroups - 1) / numOfSamples);
+		#pragma omp parallel for schedule(static) num_threads(threads)
+		for(int square=firstSquare; square<=lastSquare; square++) {
+			size_t beginGroup = std::max(firstGroup, square * numOfSamples) - firstGroup;
+			size_t endGroup = std::min(firstGroup + numOfWaveGroups, (square + 1) * numOfSamples) - firstGroup;
+			for(size_t slot=beginGroup * RAY_PACKET_SIZE; slot<endGroup * RAY_PACKET_SIZE; slot++) {
+				if(pixels[slot] != noPixel) (*m_imagePtr)[pixels[slot]] += colors[slot] / (float)numOfSamples;
+			}
+		}
+		endStage(Accumulation);
+	}
+
+	std::string stages;
+	for(int stage=0; stage<NumOfWavefrontStages; stage++) stages += std::string(stage > 0 ? ", " : "") + stageNames[stage] + " " + std::to_string(stageTimes[stage]) + "ms";
+	Console::print ("Wavefront stages: " + stages);
+}
+
+void RayTracer::renderProgressive (const std::shared_ptr<Scene> scenePtr, double timeBudget) {
+	std::chrono::high_resolution_clock clock;
+	const std::chrono::time_point<std::chrono::high_resolution_clock> deadline = clock.now() + std::chrono::microseconds((long long)(timeBudget * 1000.0));
+	size_t width = m_imagePtr->width();
+	size_t height = m_imagePtr->height();
+	size_t numOfTilesX = (width  + tileSize - 1) / tileSize;
+	size_t numOfTilesY = (height + tileSize - 1) / tileSize;
+	int numOfTiles = (int)(numOfTilesX * numOfTilesY);
+
+	// The samples so far only hold for the same view
+	glm::mat4 viewMat = scenePtr->camera()->computeViewMatrix ();
+	glm::mat4 projectionMat = scenePtr->camera()->computeProjectionMatrix ();
+	if (m_tileSamples.size () != (size_t)numOfTiles || m_accumulation.size () != width*height || viewMat != m_progressiveViewMat || projectionMat != m_progressiveProjectionMat) {
+		m_tileSamples.assign (numOfTiles, 0);
+		m_accumulation.assign (width*height, glm::vec3(0.0f, 0.0f, 0.0f));
+		m_progressivePasses = 0;
+		m_progressiveViewMat = viewMat;
+		m_progressiveProjectionMat = projectionMat;
+	}
+	if (m_progressivePasses >= progressiveMaxSamples) return;
+
+	std::vector<glm::mat4> modelViewMats;
+	std::vector<glm::mat4> normalMats;
+	prepareFrame(scenePtr, true, modelViewMats, normalMats);
+	int threads = (numOfThreads > 0) ? numOfThreads : omp_get_max_threads();
+	// A stratified grid needs the number of samples up front, the sequences go on with any number
+	Sampler sampler (samplerType == SamplerType::Stratified ? SamplerType::Sobol : samplerType, (uint32_t)progressiveMaxSamples);
+
+	// A pass adds a sample to every tile, the tiles it did not reach before the deadline being continued by the next call
+	while (m_progressivePasses < progressiveMaxSamples && clock.now() < deadline) {
+		const uint32_t pass = (uint32_t)m_progressivePasses;
+		int numOfPendingTiles = 0;
+		#pragma omp parallel for schedule(dynamic, 1) num_threads(threads) reduction(+:numOfPendingTiles)
+		for(int tile=0; tile<numOfTiles; tile++) {
+			if(m_tileSamples[tile] > pass) continue;
+			if(clock.now() >= deadline) {
+				numOfPendingTiles++;
+				continue;
+			}
+			size_t startX = (tile % numOfTilesX) * tileSize;
+			size_t startY = (tile / numOfTilesX) * tileSize;
+			size_t endX = std::min(width,  startX + tileSize);
+			size_t endY = std::min(height, startY + tileSize);
+			glm::vec3 colors[RAY_PACKET_SIZE];
+			for(size_t blockY=startY; blockY<endY; blockY+=RAY_PACKET_WIDTH) {
+				for(size_t blockX=startX; blockX<endX; blockX+=RAY_PACKET_WIDTH) {
+					size_t blockEndX = std::min(endX, blockX + RAY_PACKET_WIDTH);
+					size_t blockEndY = std::min(endY, blockY + RAY_PACKET_WIDTH);
+					std::fill(colors, colors + RAY_PACKET_SIZE, glm::vec3(0.0f, 0.0f, 0.0f));
+					traceBlock(scenePtr, sampler, blockX, blockY, blockEndX, blockEndY, pass, modelViewMats, normalMats, colors);
+
+					size_t i = 0;
+					for(size_t y=blockY; y<blockEndY; y++) {
+						for(size_t x=blockX; x<blockEndX; x++) {
+							m_accumulation[y*width + x] += colors[i++];
+							m_imagePtr->operator()(x,y) = m_accumulation[y*width + x] / (float)(pass + 1);
+						}
+					}
+				}
+			}
+			m_tileSamples[tile]++;
+		}
+		if(numOfPendingTiles == 0) m_progressivePasses++;
+	}
+}
+
+void RayTracer::benchmarkRaySorting (const std::shared_ptr<Scene> scenePtr) {
+	const bool wasWavefront = useWavefront;
+	const bool wasOcclusion = useOcclusion;
+	const bool wasSorting = sortSecondaryRays;
+	useWavefront = true;
+	useOcclusion = true;
+
+	// Best of a few renderings each way, the first one of all warming the caches up
+	static const int numOfRuns = 3;
+	double unsortedTime = std::numeric_limits<double>::max();
+	double sortedTime = std::numeric_limits<double>::max();
+	double sortingTime = 0.0;
+	for(int run=0; run<numOfRuns; run++) {
+		for(int sorted=0; sorted<2; sorted++) {
+			sortSecondaryRays = (sorted == 1);
+			render (scenePtr);
+			double time = m_wavefrontStageTimes[Occlusion];
+			if(!sortSecondaryRays) unsortedTime = std::min(unsortedTime, time);
+			else if(time < sortedTime) {
+				sortedTime = time;
+				sortingTime = m_wavefrontStageTimes[RaySorting];
+			}
+		}
+	}
+	useWavefront = wasWavefront;
+	useOcclusion = wasOcclusion;
+	sortSecondaryRays = wasSorting;
+	Console::print ("Shadow ray traversal: " + std::to_string(unsortedTime) + "ms unsorted, " + std::to_string(sortedTime) + "ms sorted + "
+		+ std::to_string(sortingTime) + "ms to sort (best of " + std::to_string(numOfRuns) + " renderings)");
+}
+
+glm::vec3 RayTracer::shade(const std::shared_ptr<Scene>& scenePtr, RayHit& rayHit, size_t& instance_index, size_t& triangle_index, uint32_t pixelIndex, uint32_t sampleIndex) {
+	glm::mat4 modelMat = scenePtr->instance(instance_index).transform->computeTransformMatrix ();
 	glm::mat4 viewMat = scenePtr->camera()->computeViewMatrix ();
 	glm::mat4 modelViewMat = viewMat * modelMat;
 	glm::mat4 normalMat = glm::transpose (glm::inverse (modelViewMat));
 
-	return shade(scenePtr, rayHit, mesh_index, triangle_index, modelViewMat, normalMat);
+	return shade(scenePtr, rayHit, instance_index, triangle_index, modelViewMat, normalMat, pixelIndex, sampleIndex);
+}
+
+glm::vec3 RayTracer::shade(const std::shared_ptr<Scene>& scenePtr, RayHit& rayHit, size_t& instance_index, size_t& triangle_index, const glm::mat4& modelViewMat, const glm::mat4& normalMat, uint32_t pixelIndex, uint32_t sampleIndex) {
+	ShadingPoint point = shadingPoint(scenePtr, rayHit, instance_index, triangle_index, modelViewMat, normalMat);
+	// The secondary rays need the BVH
+	if(useBVH) return integratorPtr->radiance(*this, scenePtr, point, normalMat, pixelIndex, sampleIndex);
+	return directLighting(scenePtr, point, normalMat, pixelIndex, sampleIndex);
 }
 
-glm::vec3 RayTracer::shade(const std::shared_ptr<Scene> scenePtr, RayHit& rayHit, size_t& mesh_index, size_t& triangle_index, glm::mat4& modelViewMat, glm::mat4& normalMat) {
-	// To compute the shading
+glm::vec3 RayTracer::directLighting(const std::shared_ptr<Scene>& scenePtr, ShadingPoint& point, const glm::mat4& normalMat, uint32_t pixelIndex, uint32_t sampleIndex, uint32_t lightDimension) {
+	glm::vec3 r = glm::vec3(0., 0., 0.);
+
+	// The lights lighting the point are gathered, then their BRDF evaluated and their shadow rays traced by batches
+	ShadowRay shadowRays[SHADOW_RAY_BATCH_SIZE];
+	glm::vec3 lights[SHADOW_RAY_BATCH_SIZE];
+	BRDFBatch batch;
+	auto traceBatch = [&]() {
+		BRDF::evaluate(*point.material, batch);
+		if(useOcclusion) fastIntersect(scenePtr, shadowRays, batch.size);
+		for(size_t i=0; i<batch.size; i++) {
+			if(!useOcclusion || !shadowRays[i].occluded) r += lights[i] * batch.result(i);
+		}
+		batch.clear();
+	};
+	forEachLight(scenePtr, point, pixelIndex, sampleIndex, [&](size_t lightIndex, float weight) {
+		glm::vec3 wi;
+		if(incidentLight(scenePtr, point, lightIndex, normalMat, wi, lights[batch.size], shadowRays[batch.size])) {
+			lights[batch.size] *= weight;
+			batch.push(point.fNormal, point.w0, wi);
+		}
+		if(batch.size == SHADOW_RAY_BATCH_SIZE) traceBatch();
+	}, lightDimension);
+	traceBatch();
+
+	return r;
+}
+
+ShadingPoint RayTracer::shadingPoint(const std::shared_ptr<Scene>& scenePtr, RayHit& rayHit, size_t instance_index, size_t triangle_index, const glm::mat4& modelViewMat, const glm::mat4& normalMat) {
+	ShadingPoint point;
+	const MeshInstance& instance = scenePtr->instance(instance_index);
+	size_t mesh_index = instance.mesh_index;
 	const std::shared_ptr<Mesh>& mesh = scenePtr->mesh(mesh_index);
 	size_t materialIndex = scenePtr->getMaterialOfMesh(mesh_index);
-	std::shared_ptr<Material> material  = scenePtr->material(materialIndex);
+	point.material = scenePtr->material(materialIndex);
 	const std::vector<glm::vec3>& vertexPositions  = mesh->vertexPositions();
 	const std::vector<glm::vec3>& vertexNormals    = mesh->vertexNormals();
 	const std::vector<glm::uvec3>& triangleIndices = mesh->triangleIndices();
@@ -156,74 +766,61 @@ glm::vec3 RayTracer::shade(const std::shared_ptr<Scene> scenePtr, RayHit& rayHit
 	const glm::vec3& p1 = vertexPositions[trianglePos[1]];
 	const glm::vec3& p2 = vertexPositions[trianglePos[2]];
 	const glm::vec3 interpolatedPos = rayHit.hitPosition(p1, p2, p0);
-	glm::vec3 fPosition =  glm::vec3(modelViewMat * glm::vec4(interpolatedPos, 1.0f));
+	point.fPosition = glm::vec3(modelViewMat * glm::vec4(interpolatedPos, 1.0f));
+	point.w0 = - glm::normalize(point.fPosition);
 
 	// Normal
 	const glm::vec3& n0 = vertexNormals[trianglePos[0]];
 	const glm::vec3& n1 = vertexNormals[trianglePos[1]];
 	const glm::vec3& n2 = vertexNormals[trianglePos[2]];
 	const glm::vec3 vNormal = glm::normalize(rayHit.hitPosition(n1, n2, n0));
-	glm::vec3 fNormal = glm::normalize(glm::vec3(normalMat * glm::vec4 (normalize (vNormal), 1.0)));
+	point.fNormal = glm::normalize(glm::vec3(normalMat * glm::vec4 (normalize (vNormal), 1.0)));
+
+	// The occlusion rays start from the hit in world space, pushed off the surface along the geometric normal
+	// so that they do not hit the triangle they leave. The push grows with the coordinates, as their precision.
+	// The point lights are culled in world space too, and the secondary rays of the integrator leave from there.
+	const bool withSecondaryRays = useBVH && integratorPtr->tracesSecondaryRays();
+	if(useOcclusion || withSecondaryRays || scenePtr->numOflightSourcesPoint() > 0) {
+		glm::mat4 modelMat = instance.transform->computeTransformMatrix ();
+		point.worldPosition = glm::vec3(modelMat * glm::vec4(interpolatedPos, 1.0f));
+		if(useOcclusion || withSecondaryRays) {
+			point.worldNormal = glm::normalize(glm::cross(glm::vec3(modelMat * glm::vec4(p1 - p0, 0.0f)), glm::vec3(modelMat * glm::vec4(p2 - p0, 0.0f))));
+			point.offset = SHADOW_RAY_EPSILON * std::max({ 1.0f, std::fabs(point.worldPosition.x), std::fabs(point.worldPosition.y), std::fabs(point.worldPosition.z) });
+		}
+	}
+	return point;
+}
 
+bool RayTracer::incidentLight(const std::shared_ptr<Scene>& scenePtr, ShadingPoint& point, size_t lightIndex, const glm::mat4& normalMat, glm::vec3& wi, glm::vec3& light, ShadowRay& shadowRay) {
 	const size_t numOfLightSourcesDir = scenePtr->numOfLightSourcesDir();
-	glm::vec3 r = glm::vec3(0., 0., 0.);
-	Ray rayOcclusion;
-
-	for(size_t i=0; i<numOfLightSourcesDir; i++) {
-		auto lightSourcePtr = scenePtr->lightSourceDir(i);
-
-		bool hit = false;
+	if(lightIndex >= numOfLightSourcesDir) {
+		const size_t pointIndex = lightIndex - numOfLightSourcesDir;
+		const std::shared_ptr<LightSourcePoint>& lightSourcePtr = scenePtr->lightSourcePoint(pointIndex);
+		wi = m_pointLightViewPositions[pointIndex] - point.fPosition;
+		float d = glm::length(wi);
+		if(d <= 0.0f) return false;
+		wi /= d;
+		if(glm::dot(point.fNormal, wi) <= 0.0f) return false;
+		light = lightSourcePtr->color * (lightSourcePtr->intensity / (lightSourcePtr->a_c + lightSourcePtr->a_l * d + lightSourcePtr->a_q * d * d));
+
+		// The segment up to the light, which is at t = 1
 		if(useOcclusion) {
-			rayOcclusion.origin = interpolatedPos;
-			rayOcclusion.setDirection(- lightSourcePtr->direction);
-			hit = bvh.fastIntersect(scenePtr, rayOcclusion);
-		}
-
-		if(!hit) {
-			glm::vec3 lightDirection = glm::normalize(glm::vec3(normalMat * glm::vec4(lightSourcePtr->direction, 1.0)));
-			r += get_r(material, fPosition, fNormal, -lightDirection, lightSourcePtr->intensity, lightSourcePtr->color);
+			float side = (glm::dot(point.worldNormal, lightSourcePtr->position - point.worldPosition) >= 0.0f) ? 1.0f : -1.0f;
+			glm::vec3 origin = point.worldPosition + side * point.offset * point.worldNormal;
+			shadowRay = { Ray(origin, lightSourcePtr->position - origin), 0.0f, 1.0f, false };
 		}
+		return true;
 	}
 
-	return r;
-}
+	auto lightSourcePtr = scenePtr->lightSourceDir(lightIndex);
+	wi = - glm::normalize(glm::vec3(normalMat * glm::vec4(lightSourcePtr->direction, 1.0)));
+	if(glm::dot(point.fNormal, wi) <= 0.0f) return false; // Behind the surface, no light and no shadow ray
+	light = lightSourcePtr->intensity * lightSourcePtr->color;
 
-glm::vec3 RayTracer::get_fd(std::shared_ptr<Material> material) {
-	return material->albedo() / (float)(PI);
-}
-
-glm::vec3 RayTracer::get_fs(std::shared_ptr<Material> material, glm::vec3& w0, glm::vec3& wi, glm::vec3& wh, glm::vec3& n) {
-	float alpha = material->roughness();
-	float alpha2 = pow(alpha, 2.0f);
-		
-	float n_wh2 = pow(std::max(0.0f, dot(n, wh)), 2.0f);
-	float n_wi = glm::dot(n, wi);
-	float n_w0 = glm::dot(n, w0);
-	float wi_wh = std::max(0.0f, glm::dot(wi, wh));
-	float D = alpha2 / (PI * pow(1.0f + (alpha2 - 1.0f) * n_wh2, 2.0f));
-		
-	glm::vec3 F0 = material->albedo() + (glm::vec3(1.) - material->albedo()) * material->metallicness();
-	glm::vec3 F = F0 - (float)(pow(1.0f - wi_wh, 5.0f)) * (glm::vec3(1.0f) - F0);
-		
-	float G1 = 2.0f * n_wi / (n_wi+sqrt(alpha2+(1-alpha2)*pow(n_wi, 2.0f)));
-	float G2 = 2.0f * n_w0 / (n_w0+sqrt(alpha2+(1-alpha2)*pow(n_w0, 2.0f)));
-	float G = G1 * G2;
-		
-	glm::vec3 fs = D*F*G/(4*n_wi*n_w0);
-	return fs;
-}
-
-glm::vec3 RayTracer::get_r(std::shared_ptr<Material> material, glm::vec3& fPosition, glm::vec3& fNormal, glm::vec3& lightDirection, float& lightIntensity, glm::vec3& lightColor) {
-	glm::vec3 w0 = - glm::normalize(fPosition);
-	glm::vec3& wi = lightDirection;
-	glm::vec3 wh = glm::normalize(wi + w0);
-
-	glm::vec3& n = fNormal;
-	glm::vec3 fs = get_fs(material, w0, wi, wh, n);
-	glm::vec3 fd = get_fd(material);
-
-	float scalarProd = max(0.0f, dot(n, wi));
-	glm::vec3 luminosity = lightIntensity * lightColor;
-		
-	return luminosity * (fd + fs) * scalarProd;
-}
\ No newline at end of file
+	if(useOcclusion) {
+		glm::vec3 toLight = - lightSourcePtr->direction;
+		float side = (glm::dot(point.worldNormal, toLight) >= 0.0f) ? 1.0f : -1.0f;
+		shadowRay = { Ray(point.worldPosition + side * point.offset * point.worldNormal, toLight), 0.0f, std::numeric_limits<float>::max(), false };
+	}
+	return true;
+}
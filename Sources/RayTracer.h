@@ -24,10 +24,22 @@
 #include "RayHit.h"
 #include "Triangle.h"
 #include "Material.h"
+#include "Sampler.h"
 #include "BVH/BVH.h"
+#include "BVH/TLAS.h"
+#include "BVH/RaySorter.h"
+#include "Light/LightBVH.h"
+#include "Light/LightTree.h"
+#include "Integrator/Integrator.h"
 
 using namespace std;
 
+static const float SHADOW_RAY_EPSILON (1e-4f); // Offset of the shadow rays off the surface, relative to the magnitude of the hit position
+static const size_t RAY_WAVEFRONT_SIZE (1 << 16); // Camera rays of a wave of the wavefront renderer, a multiple of RAY_PACKET_SIZE
+static const uint32_t LIGHT_SAMPLE_DIMENSION (1); // Of the sampler, for picking lights, the anti-aliasing using the first one
+static const double PROGRESSIVE_TIME_BUDGET (30.0); // Of tracing per call of the progressive rendering, in ms
+static const size_t RAY_WAVEFRONT_SHADOW_RAYS (1 << 20); // Shadow ray slots of a wave, the waves having fewer camera rays in scenes with many lights
+
 class RayTracer {
 public:
 	
@@ -36,20 +48,121 @@ public:
 
 	inline void setResolution (int width, int height) { m_imagePtr = make_shared<Image> (width, height); }
 	inline std::shared_ptr<Image> image () { return m_imagePtr; }
+	/// Samples taken by every pixel of the last rendering with adaptive sampling, from blue (adaptiveMinSamples) to red (adaptiveMaxSamples).
+	inline std::shared_ptr<Image> sampleHeatmap () { return m_sampleHeatmapPtr; }
 	void init (const std::shared_ptr<Scene> scenePtr);
 	void render (const std::shared_ptr<Scene> scenePtr);
+	/// To call after the vertices of a mesh moved, much cheaper than init as long as the BVH stays good enough.
+	void refit (const std::shared_ptr<Scene> scenePtr, size_t meshIndex);
+	/// Progressive rendering for the interactive view: every call traces for about 'timeBudget' ms, adding one sample to
+	/// the tiles it reaches, and writes the mean of the samples of these tiles to the image. Starts over when the camera
+	/// or the resolution changes, or after resetProgressive. Always uses the BVH.
+	void renderProgressive (const std::shared_ptr<Scene> scenePtr, double timeBudget = PROGRESSIVE_TIME_BUDGET);
+	inline void resetProgressive () { m_tileSamples.clear (); }
+	/// Samples of every pixel of the progressive rendering so far.
+	inline size_t progressiveSamples () const { return m_progressivePasses; }
+	/// Renders with the wavefront renderer and the occlusion, without then with the sorting of the shadow rays,
+	/// and prints the time spent on the shadow rays each way.
+	void benchmarkRaySorting (const std::shared_ptr<Scene> scenePtr);
+
+	/// Light carried back along a camera ray by its hit, from the integrator with the BVH, from directLighting otherwise.
+	/// 'pixelIndex' and 'sampleIndex' seed the random choices, such as the picking of the lights with useLightSampling.
+	glm::vec3 shade(const std::shared_ptr<Scene>& scenePtr, RayHit& rayHit, size_t& instance_index, size_t& triangle_index, uint32_t pixelIndex = 0, uint32_t sampleIndex = 0);
+	glm::vec3 shade(const std::shared_ptr<Scene>& scenePtr, RayHit& rayHit, size_t& instance_index, size_t& triangle_index, const glm::mat4& modelViewMat, const glm::mat4& normalMat, uint32_t pixelIndex = 0, uint32_t sampleIndex = 0);
+	/// Light of the light sources reflected at 'point' towards 'point.w0', their shadow rays being traced by batches.
+	/// 'lightDimension' is the first dimension of the sampler picking the lights, which a path moves on at every surface.
+	glm::vec3 directLighting(const std::shared_ptr<Scene>& scenePtr, ShadingPoint& point, const glm::mat4& normalMat, uint32_t pixelIndex, uint32_t sampleIndex, uint32_t lightDimension = LIGHT_SAMPLE_DIMENSION);
+	ShadingPoint shadingPoint(const std::shared_ptr<Scene>& scenePtr, RayHit& rayHit, size_t instance_index, size_t triangle_index, const glm::mat4& modelViewMat, const glm::mat4& normalMat);
+	/// Light arriving at 'point' from the light 'lightIndex', from the direction 'wi' (view space), if 'shadowRay' is not occluded (with useOcclusion).
+	/// The directional lights come first, then the point lights. Returns false for a light behind the surface.
+	bool incidentLight(const std::shared_ptr<Scene>& scenePtr, ShadingPoint& point, size_t lightIndex, const glm::mat4& normalMat, glm::vec3& wi, glm::vec3& light, ShadowRay& shadowRay);
 
-	glm::vec3 shade(const std::shared_ptr<Scene> scenePtr, RayHit& rayHit, size_t& mesh_index, size_t& triangle_index);
-	glm::vec3 shade(const std::shared_ptr<Scene> scenePtr, RayHit& rayHit, size_t& mesh_index, size_t& triangle_index, glm::mat4& modelViewMat, glm::mat4& normalMat);
-	glm::vec3 get_fd(std::shared_ptr<Material> material);
-	glm::vec3 get_fs(std::shared_ptr<Material> material, glm::vec3& w0, glm::vec3& wi, glm::vec3& wh, glm::vec3& n);
-	glm::vec3 get_r (std::shared_ptr<Material> material, glm::vec3& fPosition, glm::vec3& fNormal, glm::vec3& lightDirection, float& lightIntensity, glm::vec3& lightColor);
+	bool intersect(const std::shared_ptr<Scene>& scenePtr, RayHit& rayHit, const Ray& ray, size_t& instance_index, size_t& triangle_index) const;
+	bool fastIntersect(const std::shared_ptr<Scene>& scenePtr, const Ray& ray, float tmin = 0.0f, float tmax = std::numeric_limits<float>::max()) const;
+	void fastIntersect(const std::shared_ptr<Scene>& scenePtr, ShadowRay* shadowRays, size_t count) const;
 
+	/// Of the frame being rendered, for the integrators.
+	inline const glm::mat4& modelViewMatrix (size_t instance_index) const { return m_modelViewMats[instance_index]; }
+	inline const glm::mat4& normalMatrix (size_t instance_index) const { return m_normalMats[instance_index]; }
+	inline const glm::mat4& viewToWorld () const { return m_viewToWorld; }
+
+	std::shared_ptr<Integrator> integratorPtr; // Of the hits of the camera rays, a DirectIntegrator by default
 	bool useBVH = true;
+	BVHSplitMethod bvhSplitMethod = BVHSplitMethod::SAH;
+	BVHMortonPrecision bvhMortonPrecision = BVHMortonPrecision::Bits30; // Only for the LBVH builder
+	BVHLayout bvhLayout = BVHLayout::Linear; // Of the bottom level BVH of each mesh
+	size_t bvhMaxLeafSize = BVH_MAX_LEAF_SIZE; // Triangles per leaf, up to BVH_LEAF_SIZE_LIMIT
+	bool useBVHCache = true; // Reuse the BVHs saved next to the mesh files, except for the tree layout
+	float bvhMaxDegradation = BVH_REFIT_MAX_DEGRADATION; // Growth of the SAH cost of a refitted BVH before it is rebuilt
+	bool usePackets = true; // Trace the camera rays by squares of RAY_PACKET_WIDTH pixels, with the linear layout
+	bool useWavefront = false; // Render stage by stage over waves of RAY_WAVEFRONT_SIZE rays rather than pixel by pixel, with the BVH
 	bool useOcclusion = false;
+	bool useLightCulling = true; // Skip the point lights whose attenuated intensity at a shading point is under POINT_LIGHT_CUTOFF
+	bool useLightSampling = false; // Rather than all the lights, shade lightSamples lights picked at random by the light tree
+	size_t lightSamples = 1; // Per camera ray, each with one shadow ray
+	bool sortSecondaryRays = false; // Sort the shadow rays of a wave by direction octant and origin before tracing them, with the wavefront renderer
 	int alias_number = 1;
+	SamplerType samplerType = SamplerType::Stratified; // Placement of the anti-aliasing samples
+	bool useAdaptiveSampling = false; // Rather than alias_number^2 samples per pixel, sample until the standard error of the luminance gets under adaptiveThreshold, with the BVH
+	size_t adaptiveMinSamples = 4; // Per pixel, to estimate the variance
+	size_t adaptiveMaxSamples = 64; // Per pixel
+	float adaptiveThreshold = 1.0f / 256.0f; // Standard error of the mean luminance of a pixel, 1/256 being one level of an 8 bit display
+	size_t progressiveMaxSamples = 1024; // Per pixel, after which the progressive rendering stops
+	int numOfThreads = 0; // 0 to use all the cores
+	size_t tileSize = 16; // Side of the square tiles distributed to the threads, in pixels
 	
 private:
+	enum WavefrontStage { Generation, Tracing, Sorting, Shading, RaySorting, Occlusion, Accumulation, NumOfWavefrontStages };
+
+	/// Updates the top level of the BVH (with 'withBVH'), the lights and the camera vectors for a frame, and returns the matrices of the instances.
+	void prepareFrame (const std::shared_ptr<Scene>& scenePtr, bool withBVH, std::vector<glm::mat4>& modelViewMats, std::vector<glm::mat4>& normalMats);
+	/// Position on the screen of the sample 'sampleIndex' of the pixel (x, y), at its center without anti-aliasing.
+	glm::vec2 screenPosition(const Sampler& sampler, size_t x, size_t y, uint32_t sampleIndex) const;
+	/// Adds to 'colors' (row major) one sample of the pixels of a block of at most RAY_PACKET_WIDTH pixels a side,
+	/// traced as a packet with usePackets, with the BVH. Only the pixels of the bits set in 'activeMask' are traced.
+	void traceBlock(const std::shared_ptr<Scene>& scenePtr, const Sampler& sampler, size_t blockX, size_t blockY, size_t blockEndX, size_t blockEndY, uint32_t sampleIndex,
+					const std::vector<glm::mat4>& modelViewMats, const std::vector<glm::mat4>& normalMats, glm::vec3* colors, uint32_t activeMask = 0xffffffffu);
+	/// Tile renderer where the pixels of a block take samples until they all converge, then fills the heatmap.
+	void renderAdaptive(const std::shared_ptr<Scene>& scenePtr, const std::vector<glm::mat4>& modelViewMats, const std::vector<glm::mat4>& normalMats);
+	/// Camera rays, then their hits sorted by material, shading and shadow rays are each processed for a whole wave of rays.
+	void renderWavefront(const std::shared_ptr<Scene>& scenePtr, const std::vector<glm::mat4>& modelViewMats, const std::vector<glm::mat4>& normalMats);
+
+	/// Calls 'f' with the index, as for incidentLight, of every light to shade at 'point' and the weight of its contribution:
+	/// every light which may light the point, or the ones picked by the light tree over their probability.
+	template <typename F>
+	void forEachLight(const std::shared_ptr<Scene>& scenePtr, const ShadingPoint& point, uint32_t pixelIndex, uint32_t sampleIndex, F f, uint32_t dimension = LIGHT_SAMPLE_DIMENSION) const {
+		if(useLightSampling) {
+			for(size_t s=0; s<lightSamples; s++) {
+				size_t lightIndex;
+				float pdf;
+				if(m_lightTree.sample(point.worldPosition, m_lightSampler.get1D(pixelIndex, sampleIndex, dimension + (uint32_t)s), lightIndex, pdf))
+					f(lightIndex, 1.0f / (pdf * (float)lightSamples));
+			}
+			return;
+		}
+		const size_t numOfLightSourcesDir = scenePtr->numOfLightSourcesDir();
+		for(size_t i=0; i<numOfLightSourcesDir; i++) f(i, 1.0f);
+		m_lightBVH.forEachLight(point.worldPosition, [&](uint32_t i) { f(numOfLightSourcesDir + i, 1.0f); });
+	}
+
 	std::shared_ptr<Image> m_imagePtr;
-	BVH bvh;
+	std::shared_ptr<Image> m_sampleHeatmapPtr;
+	TLAS tlas;
+	LightBVH m_lightBVH; // Of the point lights, rebuilt by every rendering
+	LightTree m_lightTree; // Only with useLightSampling
+	Sampler m_lightSampler;
+	std::vector<glm::vec3> m_pointLightViewPositions;
+	double m_wavefrontStageTimes[NumOfWavefrontStages] = {}; // Of the last wavefront rendering, in ms
+	glm::vec3 m_viewRight, m_viewUp, m_viewDir, m_eye; // Of the camera, for the rays of the frame
+	float m_w = 0.0f;
+	std::vector<glm::mat4> m_modelViewMats; // Of the instances for the frame, with the BVH
+	std::vector<glm::mat4> m_normalMats;
+	glm::mat4 m_viewToWorld;
+
+	// Progressive rendering
+	std::vector<glm::vec3> m_accumulation; // Sum of the samples of every pixel
+	std::vector<uint32_t> m_tileSamples; // Samples of every tile, empty to start over
+	size_t m_progressivePasses = 0; // Samples of all the tiles
+	glm::mat4 m_progressiveViewMat;
+	glm::mat4 m_progressiveProjectionMat;
 };
\ No newline at end of file
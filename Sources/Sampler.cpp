@@ -0,0 +1,95 @@
+#include "Sampler.h"
+
+#include <cmath>
+
+namespace {
+
+/// Direction numbers of the second dimension of Sobol's sequence (primitive polynomial x + 1).
+struct SobolMatrix {
+	uint32_t v[32];
+	SobolMatrix () {
+		uint32_t m = 1;
+		for (int k = 0; k < 32; k++) {
+			v[k] = m << (31 - k);
+			m = (m << 1) ^ m;
+		}
+	}
+};
+const SobolMatrix sobolDim1;
+
+inline uint32_t reverseBits (uint32_t v) {
+	v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+	v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+	v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+	v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+	return (v >> 16) | (v << 16);
+}
+
+/// Owen scrambling of the bits of 'v' from the highest one, as a hash (Laine and Karras 2011, Burley 2020).
+/// A permutation which maps every aligned block of 2^k integers onto another one.
+inline uint32_t nestedUniformScramble (uint32_t v, uint32_t seed) {
+	v = reverseBits (v);
+	v += seed;
+	v ^= v * 0x6c50b47cu;
+	v ^= v * 0xb82f1e52u;
+	v ^= v * 0xc7afe638u;
+	v ^= v * 0x8d22f6e6u;
+	return reverseBits (v);
+}
+
+inline uint32_t sobol (uint32_t index, int dim) {
+	if (dim == 0) return reverseBits (index); // Van der Corput
+	uint32_t result = 0;
+	for (int k = 0; index != 0; index >>= 1, k++)
+		if (index & 1u) result ^= sobolDim1.v[k];
+	return result;
+}
+
+}
+
+uint32_t Sampler::hash (uint32_t pixelIndex, uint32_t sampleIndex, uint32_t dimension) const {
+	return pcgHash (pixelIndex ^ pcgHash (sampleIndex ^ pcgHash (dimension ^ pcgHash (m_seed))));
+}
+
+uint32_t Sampler::shuffle (uint32_t pixelIndex, uint32_t sampleIndex, uint32_t dimension) const {
+	// No sample index reaches the last one, which seeds the shuffles
+	return nestedUniformScramble (sampleIndex, hash (pixelIndex, 0xffffffffu, dimension));
+}
+
+float Sampler::get1D (uint32_t pixelIndex, uint32_t sampleIndex, uint32_t dimension) const {
+	return toFloat (hash (pixelIndex, sampleIndex, 2 * dimension));
+}
+
+glm::vec2 Sampler::get2D (uint32_t pixelIndex, uint32_t sampleIndex, uint32_t dimension) const {
+	switch (m_type) {
+	case SamplerType::Stratified: {
+		// Samples past the last full grid fall back to random positions
+		uint32_t numOfStrata = m_strataPerAxis * m_strataPerAxis;
+		glm::vec2 jitter (toFloat (hash (pixelIndex, sampleIndex, 2 * dimension)), toFloat (hash (pixelIndex, sampleIndex, 2 * dimension + 1)));
+		if (sampleIndex >= numOfStrata) return jitter;
+		glm::vec2 stratum ((float)(sampleIndex % m_strataPerAxis), (float)(sampleIndex / m_strataPerAxis));
+		return (stratum + jitter) / (float)m_strataPerAxis;
+	}
+	case SamplerType::Sobol: {
+		// Random digit scrambling keeps the stratification of the sequence, the shuffle of the samples
+		// decorrelates the dimensions, which all use the first two of the sequence
+		uint32_t index = shuffle (pixelIndex, sampleIndex, dimension);
+		uint32_t scrambleX = hash (pixelIndex, 0, 2 * dimension);
+		uint32_t scrambleY = hash (pixelIndex, 0, 2 * dimension + 1);
+		return glm::vec2 (toFloat (sobol (index, 0) ^ scrambleX), toFloat (sobol (index, 1) ^ scrambleY));
+	}
+	case SamplerType::R2: {
+		// 1/g and 1/g^2 where g is the plastic number, shifted by a per-pixel rotation. The samples are shuffled
+		// per dimension as with Sobol, the rotation alone would give every dimension the same sequence
+		const double a1 = 0.7548776662466927;
+		const double a2 = 0.5698402909980532;
+		uint32_t index = shuffle (pixelIndex, sampleIndex, dimension);
+		glm::vec2 rotation (toFloat (hash (pixelIndex, 0, 2 * dimension)), toFloat (hash (pixelIndex, 0, 2 * dimension + 1)));
+		glm::vec2 p ((float)std::fmod (0.5 + a1 * index, 1.0), (float)std::fmod (0.5 + a2 * index, 1.0));
+		p = glm::fract (p + rotation);
+		return glm::min (p, glm::vec2 (0x1.fffffep-1f));
+	}
+	default:
+		return glm::vec2 (toFloat (hash (pixelIndex, sampleIndex, 2 * dimension)), toFloat (hash (pixelIndex, sampleIndex, 2 * dimension + 1)));
+	}
+}
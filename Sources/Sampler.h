@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+/// Sequence used to place the samples inside a pixel.
+enum class SamplerType {
+	Random,     // Independent samples from a per-pixel PCG stream
+	Stratified, // One jittered sample per cell of a N x N grid
+	Sobol,      // (0,2)-sequence in base 2, scrambled per pixel
+	R2          // Roberts' additive recurrence, rotated per pixel
+};
+
+/// Stateless sample generator: a sample only depends on the pixel, the sample index and the dimension,
+/// so images are reproducible whatever the number of threads and the order in which pixels are rendered.
+class Sampler {
+public:
+	Sampler (SamplerType type = SamplerType::Stratified, uint32_t samplesPerPixel = 1, uint32_t seed = 0) :
+		m_type (type), m_samplesPerPixel (samplesPerPixel), m_seed (seed) {
+		m_strataPerAxis = 1;
+		while ((m_strataPerAxis + 1) * (m_strataPerAxis + 1) <= samplesPerPixel) m_strataPerAxis++;
+	}
+
+	inline SamplerType type () const { return m_type; }
+	inline uint32_t samplesPerPixel () const { return m_samplesPerPixel; }
+
+	/// Point of [0,1)^2 for the sample of a pixel. Successive dimensions give independent pairs (e.g. lens, light):
+	/// with Sobol and R2, the samples of a pixel come in a different order in every dimension. Their first 2^k samples
+	/// keep the distribution of the sequence.
+	glm::vec2 get2D (uint32_t pixelIndex, uint32_t sampleIndex, uint32_t dimension = 0) const;
+
+	/// Number in [0,1) for the sample of a pixel.
+	float get1D (uint32_t pixelIndex, uint32_t sampleIndex, uint32_t dimension = 0) const;
+
+	/// Integer hash with good avalanche, from the PCG family (Jarzynski and Olano 2020).
+	static inline uint32_t pcgHash (uint32_t v) {
+		uint32_t state = v * 747796405u + 2891336453u;
+		uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	/// Maps 32 random bits to [0,1), without ever returning 1.
+	static inline float toFloat (uint32_t bits) { return (bits >> 8) * (1.0f / 16777216.0f); }
+
+private:
+	uint32_t hash (uint32_t pixelIndex, uint32_t sampleIndex, uint32_t dimension) const;
+	/// Index, in the sequence, of a sample of a pixel for a dimension.
+	uint32_t shuffle (uint32_t pixelIndex, uint32_t sampleIndex, uint32_t dimension) const;
+
+	SamplerType m_type;
+	uint32_t m_samplesPerPixel;
+	uint32_t m_strataPerAxis;
+	uint32_t m_seed;
+};
@@ -20,6 +20,14 @@
 #include "Light/LightSourcePoint.h"
 
 
+/// Placement of a mesh in the scene. Every mesh is placed once by its own transform when added,
+/// more instances of it can be placed with other transforms.
+struct MeshInstance {
+	size_t mesh_index;
+	std::shared_ptr<Transform> transform;
+};
+
+
 class Scene {
 public:
 	inline Scene () : m_backgroundColor (0.f, 0.f ,0.f) {
@@ -38,11 +46,23 @@ public:
 	inline std::shared_ptr<Camera> camera() { return m_camera; }
 
 	// Mesh
-	inline void add (std::shared_ptr<Mesh> mesh) { m_meshes.push_back (mesh); }
+	inline void add (std::shared_ptr<Mesh> mesh) { 
+		m_meshes.push_back (mesh);
+		m_instances.push_back ({ m_meshes.size () - 1, mesh });
+	}
 	inline size_t numOfMeshes () const { return m_meshes.size (); }
 	inline const std::shared_ptr<Mesh> mesh (size_t index) const { return m_meshes[index]; }
 	inline std::shared_ptr<Mesh> mesh (size_t index) { return m_meshes[index]; }
 
+	// Instance
+	inline size_t addInstance (size_t meshIndex, std::shared_ptr<Transform> transform) { 
+		m_instances.push_back ({ meshIndex, transform });
+		return m_instances.size () - 1;
+	}
+	inline size_t numOfInstances () const { return m_instances.size (); }
+	inline const MeshInstance & instance (size_t index) const { return m_instances[index]; }
+	inline MeshInstance & instance (size_t index) { return m_instances[index]; }
+
 	// Material
 	inline void addMaterial (std::shared_ptr<Material> material) { m_materials.push_back (material); }
 	inline size_t numOfMaterials () const { return m_materials.size (); }
@@ -68,6 +88,7 @@ public:
 	inline void clear () {
 		m_camera.reset ();
 		m_meshes.clear ();
+		m_instances.clear ();
 	}
 
 private:
@@ -76,6 +97,7 @@ private:
 
 	// Objects
 	std::vector<std::shared_ptr<Mesh> > m_meshes;
+	std::vector<MeshInstance> m_instances;
 	std::vector<std::shared_ptr<Material> > m_materials;
 	std::unordered_map<size_t, size_t> m_mesh2material;
 	float extent = 1.0f;
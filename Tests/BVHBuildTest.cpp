@@ -0,0 +1,90 @@
+// Construction of the BVH with every split method, with several threads (ctest sets OMP_NUM_THREADS):
+// the subtrees are then built in their own tasks, which only a multi-threaded run goes through.
+
+#include <cstdio>
+#include <vector>
+#include <string>
+
+#include <omp.h>
+
+#include "Sources/BVH/BVH.h"
+
+
+namespace {
+
+int numOfFailures = 0;
+
+void check(bool condition, const std::string& name) {
+    std::printf("%s: %s\n", condition ? "passed" : "FAILED", name.c_str());
+    if (!condition) numOfFailures++;
+}
+
+/// Grid of 'resolution' x 'resolution' quads, bumped so that the boxes are not flat.
+std::shared_ptr<Scene> gridScene(size_t resolution) {
+    auto meshPtr = std::make_shared<Mesh>();
+    for (size_t y = 0; y <= resolution; y++) {
+        for (size_t x = 0; x <= resolution; x++)
+            meshPtr->vertexPositions().push_back(glm::vec3((float)x, (float)y, 0.1f * (float)((x * 7 + y * 3) % 5)));
+    }
+    const unsigned int row = (unsigned int)resolution + 1;
+    for (unsigned int y = 0; y < resolution; y++) {
+        for (unsigned int x = 0; x < resolution; x++) {
+            unsigned int i = y * row + x;
+            meshPtr->triangleIndices().push_back(glm::uvec3(i, i + 1, i + row));
+            meshPtr->triangleIndices().push_back(glm::uvec3(i + 1, i + row + 1, i + row));
+        }
+    }
+    auto scenePtr = std::make_shared<Scene>();
+    scenePtr->add(meshPtr);
+    return scenePtr;
+}
+
+/// Marks the triangles of the leaves under 'node' and returns the depth of its subtree.
+size_t visit(const BVH& node, std::vector<bool>& referenced) {
+    if (node.child_left == nullptr) {
+        for (const std::pair<size_t, size_t>& triangle : node.box.triangles) referenced[triangle.second] = true;
+        return 1;
+    }
+    return 1 + std::max(visit(*node.child_left, referenced), visit(*node.child_right, referenced));
+}
+
+void testBuild(const std::shared_ptr<Scene>& scenePtr, size_t resolution, BVHSplitMethod splitMethod, const std::string& name) {
+    BVH bvh;
+    bvh.init(scenePtr, splitMethod);
+
+    const size_t numOfTriangles = scenePtr->mesh(0)->triangleIndices().size();
+    std::vector<bool> referenced(numOfTriangles, false);
+    size_t depth = visit(bvh, referenced);
+    size_t numOfReferenced = 0;
+    for (bool r : referenced) numOfReferenced += r ? 1 : 0;
+    check(numOfReferenced == numOfTriangles, name + ": every triangle is in a leaf");
+    check(depth <= BVH_MAX_DEPTH, name + ": within the traversal stacks");
+
+    // Rays straight down through the lower left triangle of some quads
+    size_t numOfMisses = 0;
+    for (size_t y = 0; y < resolution; y += 7) {
+        for (size_t x = 0; x < resolution; x += 5) {
+            Ray ray(glm::vec3((float)x + 0.3f, (float)y + 0.3f, 10.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+            RayHit rayHit;
+            size_t mesh_index = 0;
+            size_t triangle_index = 0;
+            if (!bvh.intersect(scenePtr, rayHit, ray, mesh_index, triangle_index) || triangle_index != 2 * (y * resolution + x)) numOfMisses++;
+        }
+    }
+    check(numOfMisses == 0, name + ": rays hit the triangle under them");
+}
+
+}
+
+
+int main() {
+    std::printf("%d threads\n", omp_get_max_threads());
+    // Large enough for the parallel loops near the root and the tasks below, with every method
+    const size_t resolution = 192;
+    std::shared_ptr<Scene> scenePtr = gridScene(resolution);
+    testBuild(scenePtr, resolution, BVHSplitMethod::Median, "median");
+    testBuild(scenePtr, resolution, BVHSplitMethod::SAH, "SAH");
+    testBuild(scenePtr, resolution, BVHSplitMethod::LBVH, "LBVH");
+    testBuild(scenePtr, resolution, BVHSplitMethod::SBVH, "SBVH");
+    return numOfFailures == 0 ? 0 : 1;
+}
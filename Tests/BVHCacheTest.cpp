@@ -0,0 +1,170 @@
+// Loading of damaged BVH cache files: every one of them must be rejected, none may be traversed.
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <string>
+
+#include "Sources/BVH/BVHCache.h"
+
+
+namespace {
+
+int numOfFailures = 0;
+
+void check(bool condition, const char* name) {
+    std::printf("%s: %s\n", condition ? "passed" : "FAILED", name);
+    if (!condition) numOfFailures++;
+}
+
+/// Grid of 'resolution' x 'resolution' quads, bumped so that the BVH has a few levels.
+std::shared_ptr<Scene> gridScene(const std::string& filename, size_t resolution) {
+    auto meshPtr = std::make_shared<Mesh>();
+    for (size_t y = 0; y <= resolution; y++) {
+        for (size_t x = 0; x <= resolution; x++)
+            meshPtr->vertexPositions().push_back(glm::vec3((float)x, (float)y, 0.1f * (float)((x * 7 + y * 3) % 5)));
+    }
+    const unsigned int row = (unsigned int)resolution + 1;
+    for (unsigned int y = 0; y < resolution; y++) {
+        for (unsigned int x = 0; x < resolution; x++) {
+            unsigned int i = y * row + x;
+            meshPtr->triangleIndices().push_back(glm::uvec3(i, i + 1, i + row));
+            meshPtr->triangleIndices().push_back(glm::uvec3(i + 1, i + row + 1, i + row));
+        }
+    }
+    meshPtr->setFilename(filename);
+    auto scenePtr = std::make_shared<Scene>();
+    scenePtr->add(meshPtr);
+    return scenePtr;
+}
+
+std::vector<char> readFile(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void writeFile(const std::string& filename, const std::vector<char>& bytes) {
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+}
+
+/// Offset of the nodes in a cache file, after its header.
+template <typename BVHType>
+size_t nodesOffset(const std::vector<char>& bytes, const BVHType& bvh) {
+    return bytes.size() - bvh.nodes.size() * sizeof(bvh.nodes[0]) - bvh.triangles.size() * sizeof(uint32_t);
+}
+
+/// Index of the first internal node after the root.
+size_t innerNode(const LinearBVH& bvh) {
+    for (size_t i = 1; i < bvh.nodes.size(); i++) {
+        if (bvh.nodes[i].numOfTriangles == 0) return i;
+    }
+    return 0;
+}
+
+template <size_t N>
+size_t innerNode(const WideBVH<N>& bvh) {
+    return bvh.nodes.size() > 1 ? 1 : 0;
+}
+
+void testLinear(const std::shared_ptr<Scene>& scenePtr, const std::string& filename) {
+    const BVHCacheKey key = BVHCache::computeKey(*scenePtr->mesh(0), BVHLayout::Linear, BVHSplitMethod::SAH, BVHMortonPrecision::Bits30, BVH_MAX_LEAF_SIZE);
+    LinearBVH built;
+    built.init(scenePtr);
+    check(BVHCache::save(filename, key, built), "linear: save");
+    const std::vector<char> bytes = readFile(filename);
+    const size_t offset = nodesOffset(bytes, built);
+    LinearBVH loaded;
+    check(BVHCache::load(filename, key, scenePtr, 0, loaded) && loaded.nodes.size() == built.nodes.size(), "linear: load of an intact file");
+
+    std::vector<char> truncated(bytes.begin(), bytes.end() - 4);
+    writeFile(filename, truncated);
+    check(!BVHCache::load(filename, key, scenePtr, 0, loaded) && loaded.nodes.empty(), "linear: truncated file rejected");
+
+    // Right child pointing back at the root
+    const size_t inner = innerNode(built);
+    check(inner > 0, "linear: the tree has an internal node below the root");
+    std::vector<char> backEdge = bytes;
+    LinearBVHNode node = built.nodes[inner];
+    node.rightChildOffset = 0;
+    std::memcpy(backEdge.data() + offset + inner * sizeof(LinearBVHNode), &node, sizeof(LinearBVHNode));
+    writeFile(filename, backEdge);
+    check(!BVHCache::load(filename, key, scenePtr, 0, loaded), "linear: back pointing right child rejected");
+
+    // Split axis past z, which would index the ray directions out of their bounds
+    std::vector<char> badAxis = bytes;
+    node = built.nodes[inner];
+    node.axis = 3;
+    std::memcpy(badAxis.data() + offset + inner * sizeof(LinearBVHNode), &node, sizeof(LinearBVHNode));
+    writeFile(filename, badAxis);
+    check(!BVHCache::load(filename, key, scenePtr, 0, loaded), "linear: axis past z rejected");
+
+    // Internal node as the last record, its left child would be past the array
+    std::vector<char> lastInner = bytes;
+    node = built.nodes.back();
+    node.numOfTriangles = 0;
+    node.rightChildOffset = (uint32_t)built.nodes.size() - 1;
+    std::memcpy(lastInner.data() + offset + (built.nodes.size() - 1) * sizeof(LinearBVHNode), &node, sizeof(LinearBVHNode));
+    writeFile(filename, lastInner);
+    check(!BVHCache::load(filename, key, scenePtr, 0, loaded), "linear: internal last node rejected");
+
+    // Well formed chain deeper than the traversal stacks: every internal node has a leaf on its left
+    LinearBVH deep;
+    deep.triangles = built.triangles;
+    const size_t numOfLevels = BVH_MAX_DEPTH + 1;
+    for (size_t level = 0; level < numOfLevels; level++) {
+        LinearBVHNode inner = built.nodes[0];
+        inner.numOfTriangles = 0;
+        inner.rightChildOffset = (uint32_t)(2 * level + 2);
+        LinearBVHNode leaf = built.nodes[0];
+        leaf.numOfTriangles = 1;
+        leaf.trianglesOffset = 0;
+        deep.nodes.push_back(inner);
+        deep.nodes.push_back(leaf);
+    }
+    deep.nodes.push_back(deep.nodes.back());
+    BVHCache::save(filename, key, deep);
+    check(!BVHCache::load(filename, key, scenePtr, 0, loaded), "linear: tree deeper than BVH_MAX_DEPTH rejected");
+}
+
+template <size_t N>
+void testWide(const std::shared_ptr<Scene>& scenePtr, const std::string& filename, BVHLayout layout, const char* name) {
+    const BVHCacheKey key = BVHCache::computeKey(*scenePtr->mesh(0), layout, BVHSplitMethod::SAH, BVHMortonPrecision::Bits30, BVH_MAX_LEAF_SIZE);
+    WideBVH<N> built;
+    built.init(scenePtr);
+    check(BVHCache::save(filename, key, built), (std::string(name) + ": save").c_str());
+    const std::vector<char> bytes = readFile(filename);
+    const size_t offset = nodesOffset(bytes, built);
+    WideBVH<N> loaded;
+    check(BVHCache::load(filename, key, scenePtr, 0, loaded) && loaded.nodes.size() == built.nodes.size(), (std::string(name) + ": load of an intact file").c_str());
+
+    std::vector<char> truncated(bytes.begin(), bytes.end() - 4);
+    writeFile(filename, truncated);
+    check(!BVHCache::load(filename, key, scenePtr, 0, loaded) && loaded.nodes.empty(), (std::string(name) + ": truncated file rejected").c_str());
+
+    // A child of a node pointing back at the root, which would make a cycle
+    const size_t inner = innerNode(built);
+    check(inner > 0, (std::string(name) + ": the tree has a node below the root").c_str());
+    std::vector<char> backEdge = bytes;
+    WideBVHNode<N> node = built.nodes[inner];
+    node.children[0] = 0;
+    node.numOfTriangles[0] = 0;
+    std::memcpy(backEdge.data() + offset + inner * sizeof(WideBVHNode<N>), &node, sizeof(WideBVHNode<N>));
+    writeFile(filename, backEdge);
+    check(!BVHCache::load(filename, key, scenePtr, 0, loaded), (std::string(name) + ": back pointing child rejected").c_str());
+}
+
+}
+
+
+int main() {
+    const std::string filename = "BVHCacheTest.bvh";
+    std::shared_ptr<Scene> scenePtr = gridScene("BVHCacheTest.off", 32);
+    testLinear(scenePtr, filename);
+    testWide<4>(scenePtr, filename, BVHLayout::Wide4, "bvh4");
+    testWide<8>(scenePtr, filename, BVHLayout::Wide8, "bvh8");
+    std::remove(filename.c_str());
+    return numOfFailures == 0 ? 0 : 1;
+}